@@ -0,0 +1,225 @@
+/*
+ * contention.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+/* Concurrent writer stress test. Opens one ClipmanStorage per writer on
+ * the same history.db, as two mate-clipman instances would, and has each
+ * add its own share of the synthetic corpus from a thread of its own.
+ * Fails unless every add succeeded, every item can be found afterwards
+ * and at least one write had to wait for the other writer. */
+
+#include "config.h"
+#include "corpus.h"
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+static gint opt_writers = 2;
+static gint opt_items = 2000;
+static gint64 opt_seed = 1;
+
+static const GOptionEntry entries[] = {
+  { "writers", 'w', 0, G_OPTION_ARG_INT, &opt_writers,
+    "Storage instances writing at the same time", "N" },
+  { "items", 'n', 0, G_OPTION_ARG_INT, &opt_items,
+    "Items added by each writer", "N" },
+  { "seed", 0, 0, G_OPTION_ARG_INT64, &opt_seed,
+    "Seed of the synthetic corpus", "SEED" },
+  { NULL }
+};
+
+typedef struct
+{
+  ClipmanStorage *storage;
+  guint first;
+  guint n_failed;
+  GPtrArray *checksums;
+} Writer;
+
+static gpointer
+run_writer (gpointer data)
+{
+  Writer *writer = data;
+  gint i;
+
+  for (i = 0; i < opt_items; i++)
+    {
+      ClipmanItem *item = corpus_make_item (opt_seed, writer->first + i,
+                                            CORPUS_MIXED);
+
+      if (clipman_storage_add_item (writer->storage, item))
+        g_ptr_array_add (writer->checksums,
+                         g_strdup (clipman_item_get_checksum (item)));
+      else
+        writer->n_failed++;
+
+      g_object_unref (item);
+    }
+
+  return NULL;
+}
+
+static void
+remove_database (const gchar *dir)
+{
+  GDir *d = g_dir_open (dir, 0, NULL);
+  const gchar *name;
+
+  while (d && (name = g_dir_read_name (d)))
+    {
+      gchar *path = g_build_filename (dir, name, NULL);
+
+      g_remove (path);
+      g_free (path);
+    }
+
+  if (d)
+    g_dir_close (d);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  ClipmanStorage *storage;
+  ClipmanStorageStats stats;
+  GThread **threads;
+  Writer *writers;
+  gchar *dir;
+  gchar *path;
+  guint n_failed = 0;
+  guint n_missing = 0;
+  guint n_stored = 0;
+  gint64 n_contended = 0;
+  gint64 start;
+  gint64 elapsed;
+  gint i;
+  guint j;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("contention: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (opt_writers < 2 || opt_items < 1)
+    {
+      g_printerr ("contention: needs at least two writers and one item\n");
+      return 2;
+    }
+
+  dir = g_dir_make_tmp ("clipman-bench-XXXXXX", &error);
+  if (!dir)
+    {
+      g_printerr ("contention: %s\n", error->message);
+      return 1;
+    }
+  path = g_build_filename (dir, "history.db", NULL);
+
+  /* Open one after another, so only the writes overlap */
+  writers = g_new0 (Writer, opt_writers);
+  threads = g_new0 (GThread *, opt_writers);
+  for (i = 0; i < opt_writers; i++)
+    {
+      writers[i].storage = clipman_storage_new_for_path (path, NULL);
+      writers[i].first = i * opt_items;
+      writers[i].checksums = g_ptr_array_new_with_free_func (g_free);
+    }
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < opt_writers; i++)
+    threads[i] = g_thread_new ("writer", run_writer, &writers[i]);
+  for (i = 0; i < opt_writers; i++)
+    g_thread_join (threads[i]);
+  elapsed = g_get_monotonic_time () - start;
+
+  for (i = 0; i < opt_writers; i++)
+    {
+      n_failed += writers[i].n_failed;
+      if (clipman_storage_get_stats (writers[i].storage, &stats))
+        n_contended += stats.n_contended;
+    }
+
+  /* Look everything up through a connection of its own */
+  storage = clipman_storage_new_for_path (path, NULL);
+  for (i = 0; i < opt_writers; i++)
+    for (j = 0; j < writers[i].checksums->len; j++)
+      {
+        ClipmanItem *item = clipman_storage_get_by_checksum (
+            storage, g_ptr_array_index (writers[i].checksums, j));
+
+        if (item)
+          {
+            n_stored++;
+            g_object_unref (item);
+          }
+        else
+          {
+            n_missing++;
+          }
+      }
+
+  printf ("{\n  \"benchmark\": \"contention\",\n  \"writers\": %d,\n"
+          "  \"items_per_writer\": %d,\n  \"failed\": %u,\n"
+          "  \"stored\": %u,\n  \"missing\": %u,\n"
+          "  \"contended\": %" G_GINT64_FORMAT ",\n"
+          "  \"items_per_second\": %.0f\n}\n",
+          opt_writers, opt_items, n_failed, n_stored, n_missing,
+          n_contended,
+          elapsed > 0 ? opt_writers * opt_items * 1e6 / elapsed : 0.0);
+
+  g_object_unref (storage);
+  for (i = 0; i < opt_writers; i++)
+    {
+      g_object_unref (writers[i].storage);
+      g_ptr_array_unref (writers[i].checksums);
+    }
+  g_free (threads);
+  g_free (writers);
+
+  remove_database (dir);
+  g_rmdir (dir);
+  g_free (path);
+  g_free (dir);
+
+  if (n_failed > 0 || n_missing > 0)
+    {
+      g_printerr ("contention: %u adds failed, %u items missing\n",
+                  n_failed, n_missing);
+      return 1;
+    }
+
+  if (n_contended == 0)
+    {
+      g_printerr ("contention: the writers never waited for each other\n");
+      return 1;
+    }
+
+  return 0;
+}
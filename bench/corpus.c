@@ -0,0 +1,282 @@
+/*
+ * corpus.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "corpus.h"
+#include <math.h>
+
+static const gchar *const words[] = {
+  "clipboard", "selection", "history", "window", "panel",   "sqlite",
+  "commit",    "buffer",    "display", "thread", "signal",  "memory",
+  "pixbuf",    "search",    "mate",    "gtk",    "desktop", "file",
+  "error",     "return",    "static",  "const",  "struct",  "value",
+};
+
+static const gchar *const code_lines[] = {
+  "static void",
+  "  g_return_if_fail (self != NULL);",
+  "  for (i = 0; i < n_items; i++)",
+  "    {",
+  "    }",
+  "  if (!g_file_get_contents (path, &contents, NULL, &error))",
+  "    return FALSE;",
+  "  g_signal_emit (self, signals[SIGNAL_CHANGED], 0);",
+  "def %s(self, value):",
+  "    return self.%s[value]",
+  "const %s = await fetch(url);",
+  "SELECT id, label FROM items WHERE %s = ?;",
+};
+
+static const gchar *const log_levels[] = {
+  "DEBUG", "INFO", "INFO", "INFO", "WARNING", "ERROR",
+};
+
+static const gchar *const extensions[] = {
+  "txt", "png", "jpg", "pdf", "c", "h", "odt", "tar.gz",
+};
+
+const gchar *
+corpus_word (GRand *rand)
+{
+  return words[g_rand_int_range (rand, 0, G_N_ELEMENTS (words))];
+}
+
+/* Pareto distributed size of at least MIN: most are small, a few huge */
+static gsize
+heavy_tailed (GRand *rand, gsize min, gsize max)
+{
+  gdouble size = min / pow (1.0 - g_rand_double (rand), 1.0 / 1.2);
+
+  return (gsize)MIN (size, (gdouble)max);
+}
+
+static ClipmanItem *
+new_text (GString *text, ClipmanSource source)
+{
+  ClipmanItem *item = clipman_item_new_text (text->str, source);
+
+  g_string_free (text, TRUE);
+
+  return item;
+}
+
+/* A few words, like a name, URL or command */
+static ClipmanItem *
+make_words (GRand *rand, guint index, ClipmanSource source)
+{
+  GString *text = g_string_new (NULL);
+  gint n_words = g_rand_int_range (rand, 1, 12);
+  gint i;
+
+  g_string_append_printf (text, "%u", index);
+  for (i = 0; i < n_words; i++)
+    {
+      g_string_append_c (text, ' ');
+      g_string_append (text, corpus_word (rand));
+    }
+
+  return new_text (text, source);
+}
+
+/* Prose of heavy-tailed length, up to a whole document */
+static ClipmanItem *
+make_prose (GRand *rand, guint index, ClipmanSource source)
+{
+  gsize size = heavy_tailed (rand, 64, 4 * 1024 * 1024);
+  GString *text = g_string_sized_new (size);
+  gint i = 0;
+
+  g_string_append_printf (text, "%u", index);
+  while (text->len < size)
+    {
+      g_string_append_c (text, ++i % 14 == 0 ? '\n' : ' ');
+      g_string_append (text, corpus_word (rand));
+    }
+
+  return new_text (text, source);
+}
+
+static ClipmanItem *
+make_code (GRand *rand, guint index, ClipmanSource source)
+{
+  GString *text = g_string_new (NULL);
+  gsize n_lines = heavy_tailed (rand, 3, 2000);
+  gsize i;
+
+  g_string_append_printf (text, "/* %u */\n", index);
+  for (i = 0; i < n_lines; i++)
+    {
+      const gchar *line = code_lines[g_rand_int_range (
+          rand, 0, G_N_ELEMENTS (code_lines))];
+
+      if (strstr (line, "%s"))
+        g_string_append_printf (text, line, corpus_word (rand));
+      else
+        g_string_append (text, line);
+      g_string_append_c (text, '\n');
+    }
+
+  return new_text (text, source);
+}
+
+static ClipmanItem *
+make_log (GRand *rand, guint index, ClipmanSource source)
+{
+  GString *text = g_string_new (NULL);
+  gsize n_lines = heavy_tailed (rand, 1, 5000);
+  gint64 time = 1700000000 + index * 60;
+  gsize i;
+
+  for (i = 0; i < n_lines; i++)
+    {
+      time += g_rand_int_range (rand, 0, 5);
+      g_string_append_printf (
+          text, "%" G_GINT64_FORMAT ".%03d %s [%s] %s %s: %s %u\n", time,
+          g_rand_int_range (rand, 0, 1000),
+          log_levels[g_rand_int_range (rand, 0, G_N_ELEMENTS (log_levels))],
+          corpus_word (rand), corpus_word (rand), corpus_word (rand),
+          corpus_word (rand), g_rand_int (rand));
+    }
+
+  return new_text (text, source);
+}
+
+/* Screenshot-like image: flat rectangles compress like a UI does */
+static ClipmanItem *
+make_image (GRand *rand, guint index, ClipmanSource source)
+{
+  gint width, height;
+  GdkPixbuf *pixbuf;
+  ClipmanItem *item;
+  guchar *pixels;
+  gint i;
+
+  /* Now and then a whole screen, otherwise a window or a region */
+  if (g_rand_int_range (rand, 0, 20) == 0)
+    {
+      width = 1920;
+      height = 1080;
+    }
+  else
+    {
+      width = g_rand_int_range (rand, 64, 800);
+      height = g_rand_int_range (rand, 64, 600);
+    }
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  gdk_pixbuf_fill (pixbuf, g_rand_int (rand) | 0xff);
+  for (i = 0; i < 8; i++)
+    {
+      gint x = g_rand_int_range (rand, 0, width);
+      gint y = g_rand_int_range (rand, 0, height);
+      GdkPixbuf *rect = gdk_pixbuf_new_subpixbuf (
+          pixbuf, x, y, g_rand_int_range (rand, 1, width - x + 1),
+          g_rand_int_range (rand, 1, height - y + 1));
+
+      gdk_pixbuf_fill (rect, g_rand_int (rand) | 0xff);
+      g_object_unref (rect);
+    }
+
+  /* Keep every image unique */
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  pixels[0] = index & 0xff;
+  pixels[1] = (index >> 8) & 0xff;
+  pixels[2] = (index >> 16) & 0xff;
+
+  item = clipman_item_new_image (pixbuf, source);
+  g_object_unref (pixbuf);
+
+  return item;
+}
+
+/* File list, mostly a few files but sometimes a whole directory tree */
+static ClipmanItem *
+make_files (GRand *rand, guint index, ClipmanSource source)
+{
+  gsize n_uris = heavy_tailed (rand, 1, 5000);
+  gchar **uris = g_new0 (gchar *, n_uris + 1);
+  ClipmanItem *item;
+  gsize i;
+
+  for (i = 0; i < n_uris; i++)
+    uris[i] = g_strdup_printf (
+        "file:///home/user/%s/%s/%u-%" G_GSIZE_FORMAT ".%s",
+        corpus_word (rand), corpus_word (rand), index, i,
+        extensions[g_rand_int_range (rand, 0, G_N_ELEMENTS (extensions))]);
+
+  item = clipman_item_new_files (uris, source);
+  g_strfreev (uris);
+
+  return item;
+}
+
+/* Items are generated from (seed, index) alone, so an item can be made
+ * again later to bump it without keeping the whole corpus around */
+ClipmanItem *
+corpus_make_item (guint64 seed, guint index, CorpusMix mix)
+{
+  GRand *rand = g_rand_new_with_seed ((guint32)(seed * 2654435761u + index));
+  ClipmanSource source = g_rand_int_range (rand, 0, 4) == 0
+                             ? CLIPMAN_SOURCE_PRIMARY
+                             : CLIPMAN_SOURCE_CLIPBOARD;
+  gint kind = mix == CORPUS_IMAGES ? 75 : g_rand_int_range (rand, 0, 100);
+  ClipmanItem *item;
+
+  if (kind < 45)
+    item = make_words (rand, index, source);
+  else if (kind < 55)
+    item = make_code (rand, index, source);
+  else if (kind < 63)
+    item = make_log (rand, index, source);
+  else if (kind < 75)
+    item = make_prose (rand, index, source);
+  else if (kind < 85)
+    item = make_image (rand, index, source);
+  else
+    item = make_files (rand, index, source);
+
+  g_rand_free (rand);
+
+  return item;
+}
+
+/* The index of the item copied at position INDEX: usually INDEX itself,
+ * but DUPLICATE_PERCENT of the time a repeat of a recent earlier copy */
+guint
+corpus_pick_index (guint64 seed, guint index, guint duplicate_percent)
+{
+  GRand *rand;
+  guint picked = index;
+
+  if (index == 0 || duplicate_percent == 0)
+    return index;
+
+  rand = g_rand_new_with_seed ((guint32)(seed * 40503u + index));
+  if ((guint)g_rand_int_range (rand, 0, 100) < duplicate_percent)
+    picked = index - 1 - MIN (index - 1, heavy_tailed (rand, 1, index) - 1);
+  g_rand_free (rand);
+
+  return picked;
+}
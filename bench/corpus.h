@@ -0,0 +1,48 @@
+/*
+ * corpus.h
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Synthetic clipboard history shared by the benchmarks */
+
+#ifndef __CORPUS_H__
+#define __CORPUS_H__
+
+#include "src/clipman.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  CORPUS_MIXED, /* short text, code, logs, prose, images and file lists */
+  CORPUS_IMAGES /* screenshots only */
+} CorpusMix;
+
+const gchar *corpus_word (GRand *rand);
+ClipmanItem *corpus_make_item (guint64 seed, guint index, CorpusMix mix);
+guint corpus_pick_index (guint64 seed, guint index, guint duplicate_percent);
+
+G_END_DECLS
+
+#endif /* __CORPUS_H__ */
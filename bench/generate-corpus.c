@@ -0,0 +1,136 @@
+/*
+ * generate-corpus.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Writes the synthetic corpus of the benchmarks to a history database.
+ * Items are added one at a time through ClipmanStorage, oldest first, so
+ * the result looks like a history built up by copying. The same seed and
+ * options always give the same items. */
+
+#include "config.h"
+#include "corpus.h"
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+static gint opt_items = 10000;
+static gint64 opt_seed = 1;
+static gint opt_duplicates = 10;
+static gboolean opt_images;
+
+static const GOptionEntry entries[] = {
+  { "items", 'n', 0, G_OPTION_ARG_INT, &opt_items,
+    "Number of copies to add", "N" },
+  { "seed", 0, 0, G_OPTION_ARG_INT64, &opt_seed,
+    "Seed of the synthetic corpus", "SEED" },
+  { "duplicates", 'd', 0, G_OPTION_ARG_INT, &opt_duplicates,
+    "Percentage of copies that repeat an earlier one", "PERCENT" },
+  { "images", 'i', 0, G_OPTION_ARG_NONE, &opt_images,
+    "Copy screenshots only", NULL },
+  { NULL }
+};
+
+/* Items go to the live tier; an empty archive is created again by
+ * mate-clipman next to the history */
+static void
+remove_archive (const gchar *path)
+{
+  static const gchar *const suffixes[] = { "", "-wal", "-shm" };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (suffixes); i++)
+    {
+      gchar *archive = g_strconcat (path, "-archive", suffixes[i], NULL);
+
+      g_remove (archive);
+      g_free (archive);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  ClipmanStorage *storage;
+  ClipmanStorageStats stats;
+  const gchar *path;
+  gint i;
+
+  context = g_option_context_new ("HISTORY.DB");
+  g_option_context_set_summary (
+      context, "Write a synthetic clipboard history for benchmarks.");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("generate-corpus: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (argc != 2 || opt_items < 0 || opt_duplicates < 0
+      || opt_duplicates > 100)
+    {
+      g_printerr ("usage: generate-corpus [OPTION...] HISTORY.DB\n");
+      return 2;
+    }
+  path = argv[1];
+
+  /* Never add to somebody's real history */
+  if (g_file_test (path, G_FILE_TEST_EXISTS))
+    {
+      g_printerr ("generate-corpus: %s already exists\n", path);
+      return 1;
+    }
+
+  storage = clipman_storage_new_for_path (path, NULL);
+
+  for (i = 0; i < opt_items; i++)
+    {
+      guint index = corpus_pick_index (opt_seed, i, opt_duplicates);
+      ClipmanItem *item = corpus_make_item (
+          opt_seed, index, opt_images ? CORPUS_IMAGES : CORPUS_MIXED);
+
+      if (!clipman_storage_add_item (storage, item))
+        {
+          g_printerr ("generate-corpus: failed to add item %d\n", i);
+          g_object_unref (item);
+          g_object_unref (storage);
+          return 1;
+        }
+      g_object_unref (item);
+
+      if (opt_items >= 10 && (i + 1) % (opt_items / 10) == 0)
+        g_printerr ("%d%%\r", (i + 1) * 100 / opt_items);
+    }
+
+  if (clipman_storage_get_stats (storage, &stats))
+    printf ("%s: %" G_GINT64_FORMAT " items, %" G_GINT64_FORMAT " bytes\n",
+            path, stats.total_items, stats.total_bytes);
+
+  g_object_unref (storage);
+  remove_archive (path);
+
+  return 0;
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# idle-wakeups.sh - idle wakeup test for mate-clipman
+#
+# Starts mate-clipman --daemon on a private Xvfb display, gives it time to
+# finish its startup work and then counts the context switches of all its
+# threads over an idle window.  Nothing is copied during the window, so
+# every wakeup is a timer or poll that shouldn't have been armed.
+#
+# usage: idle-wakeups.sh MATE_CLIPMAN SCHEMA_DIR [WINDOW_S]
+#
+# CLIPMAN_IDLE_SETTLE_S overrides the time allowed for startup work
+# (default 45 s, past the delayed archive migration) and
+# CLIPMAN_IDLE_WAKEUPS_MAX the number of wakeups tolerated (default 0).
+
+set -u
+
+CLIPMAN=$1
+SCHEMA_DIR=$2
+WINDOW=${3:-60}
+SETTLE=${CLIPMAN_IDLE_SETTLE_S:-45}
+MAX_WAKEUPS=${CLIPMAN_IDLE_WAKEUPS_MAX:-0}
+BENCH=idle-wakeups
+
+if [ ! -d /proc/self/task ]; then
+  echo "$BENCH: /proc not available, skipping" >&2
+  exit 77
+fi
+
+. "$(dirname "$0")/session.sh"
+
+# Prints "tid name switches" for every thread of process $1
+sample_threads () {
+  for task in /proc/"$1"/task/*; do
+    awk -v tid="${task##*/}" '
+      /^Name:/ { name = $2 }
+      /ctxt_switches/ { n += $2 }
+      END { print tid, name, n }' "$task/status" 2>/dev/null
+  done | sort -n
+}
+
+"$CLIPMAN" --daemon &
+pid=$!
+wait_for_service $pid || exit 1
+
+sleep "$SETTLE"
+sample_threads $pid >"$TMP/before"
+sleep "$WINDOW"
+sample_threads $pid >"$TMP/after"
+
+kill $pid
+wait $pid 2>/dev/null
+
+# Threads that appeared during the window count with all their switches
+wakeups=$(awk 'NR == FNR { before[$1] = $3; next }
+               { n += $3 - before[$1] } END { print n + 0 }' \
+          "$TMP/before" "$TMP/after")
+threads=$(wc -l <"$TMP/after")
+
+printf '{"benchmark": "%s", "window_s": %d, "threads": %d, ' \
+  "$BENCH" "$WINDOW" "$threads"
+printf '"wakeups": %d, "max_wakeups": %d}\n' "$wakeups" "$MAX_WAKEUPS"
+
+if [ "$wakeups" -gt "$MAX_WAKEUPS" ]; then
+  echo "$BENCH: $wakeups wakeups while idle, by thread:" >&2
+  awk 'NR == FNR { before[$1] = $3; next }
+       $3 != before[$1] { print "  " $2 " (" $1 "): " $3 - before[$1] }' \
+    "$TMP/before" "$TMP/after" >&2
+  exit 1
+fi
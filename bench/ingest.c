@@ -0,0 +1,277 @@
+/*
+ * ingest.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Clipboard owner for the ingest benchmark. Takes CLIPBOARD or PRIMARY
+ * with text, images and URI lists, and times each one from taking the
+ * selection until mate-clipman announces the stored item on D-Bus. CPU
+ * time and RSS of the mate-clipman process PID are read from /proc
+ * around every scenario. Prints the results as JSON. */
+
+#include "config.h"
+#include "owner.h"
+#include <stdio.h>
+
+/* Give up on an item that isn't stored within this time */
+#define ITEM_TIMEOUT_MS 5000
+
+typedef enum
+{
+  PAYLOAD_TEXT_SMALL,
+  PAYLOAD_TEXT_LARGE,
+  PAYLOAD_IMAGE,
+  PAYLOAD_URIS,
+  N_PAYLOADS
+} Payload;
+
+static const gchar *const payload_names[N_PAYLOADS] = {
+  "text-small",
+  "text-large",
+  "image",
+  "uris",
+};
+
+static gint opt_count = 50;
+static gint opt_interval = 100;
+static gint opt_text_size = 100;
+static gint opt_large_size = 256 * 1024;
+static gint opt_image_width = 1920;
+static gint opt_image_height = 1080;
+static gint opt_n_uris = 200;
+
+static const GOptionEntry entries[] = {
+  { "count", 'n', 0, G_OPTION_ARG_INT, &opt_count,
+    "Items to publish per payload and selection", "N" },
+  { "interval", 'i', 0, G_OPTION_ARG_INT, &opt_interval,
+    "Minimum milliseconds between two items", "MS" },
+  { "text-size", 0, 0, G_OPTION_ARG_INT, &opt_text_size,
+    "Bytes of the small text items", "BYTES" },
+  { "large-size", 0, 0, G_OPTION_ARG_INT, &opt_large_size,
+    "Bytes of the large text items", "BYTES" },
+  { "image-width", 0, 0, G_OPTION_ARG_INT, &opt_image_width,
+    "Width of the images", "PIXELS" },
+  { "image-height", 0, 0, G_OPTION_ARG_INT, &opt_image_height,
+    "Height of the images", "PIXELS" },
+  { "uris", 0, 0, G_OPTION_ARG_INT, &opt_n_uris,
+    "Files in each URI list", "N" },
+  { NULL }
+};
+
+typedef struct
+{
+  GMainLoop *loop;
+  guint timeout_id;
+  gboolean stored;
+  gint64 stored_time;
+} Wait;
+
+static void
+on_item_added (GDBusConnection *connection, const gchar *sender_name,
+               const gchar *object_path, const gchar *interface_name,
+               const gchar *signal_name, GVariant *parameters,
+               gpointer user_data)
+{
+  Wait *wait = user_data;
+
+  if (!g_main_loop_is_running (wait->loop))
+    return;
+
+  wait->stored = TRUE;
+  wait->stored_time = g_get_monotonic_time ();
+  g_main_loop_quit (wait->loop);
+}
+
+static gboolean
+on_wait_timeout (gpointer user_data)
+{
+  Wait *wait = user_data;
+
+  wait->timeout_id = 0;
+  g_main_loop_quit (wait->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Takes the selection with payload number SEQ and returns its size */
+static gsize
+publish (GtkClipboard *clipboard, Payload payload, guint seq)
+{
+  switch (payload)
+    {
+    case PAYLOAD_TEXT_SMALL:
+      return owner_publish_text (clipboard, opt_text_size, seq);
+    case PAYLOAD_TEXT_LARGE:
+      return owner_publish_text (clipboard, opt_large_size, seq);
+    case PAYLOAD_IMAGE:
+      return owner_publish_image (clipboard, opt_image_width,
+                                  opt_image_height, seq);
+    case PAYLOAD_URIS:
+      return owner_publish_uris (clipboard, opt_n_uris, 0, seq);
+    default:
+      g_assert_not_reached ();
+    }
+
+  return 0;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+run (GtkClipboard *clipboard, const gchar *selection, Payload payload,
+     const gchar *pid, Wait *wait, gboolean last)
+{
+  static guint seq;
+  GArray *samples = g_array_new (FALSE, FALSE, sizeof (gint64));
+  gint64 *values;
+  gint64 cpu_ms = owner_get_cpu_ms (pid);
+  gsize size = 0;
+  guint n_missed = 0;
+  guint n;
+  gint i;
+
+  for (i = 0; i < opt_count; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      gint64 elapsed;
+
+      wait->stored = FALSE;
+      size = publish (clipboard, payload, ++seq);
+
+      wait->timeout_id
+          = g_timeout_add (ITEM_TIMEOUT_MS, on_wait_timeout, wait);
+      g_main_loop_run (wait->loop);
+      if (wait->timeout_id)
+        g_source_remove (wait->timeout_id);
+      wait->timeout_id = 0;
+
+      if (wait->stored)
+        {
+          elapsed = wait->stored_time - start;
+          g_array_append_val (samples, elapsed);
+        }
+      else
+        {
+          n_missed++;
+        }
+
+      /* Pace the items, without letting them overlap */
+      elapsed = (g_get_monotonic_time () - start) / 1000;
+      if (elapsed < opt_interval)
+        g_usleep ((opt_interval - elapsed) * 1000);
+    }
+
+  cpu_ms = owner_get_cpu_ms (pid) - cpu_ms;
+
+  g_array_sort (samples, compare_int64);
+  values = (gint64 *)samples->data;
+  n = samples->len;
+
+#define PERCENTILE(p) (n > 0 ? values[(n - 1) * (p) / 100] : 0)
+  printf ("    {\"selection\": \"%s\", \"payload\": \"%s\", "
+          "\"bytes\": %" G_GSIZE_FORMAT ", \"stored\": %u, \"missed\": %u, "
+          "\"p50_us\": %" G_GINT64_FORMAT ", \"p90_us\": %" G_GINT64_FORMAT
+          ", \"p99_us\": %" G_GINT64_FORMAT ", \"max_us\": %" G_GINT64_FORMAT
+          ", \"cpu_ms_per_item\": %.2f, \"rss_kib\": %" G_GINT64_FORMAT
+          "}%s\n",
+          selection, payload_names[payload], size, n, n_missed,
+          PERCENTILE (50), PERCENTILE (90), PERCENTILE (99),
+          n > 0 ? values[n - 1] : 0,
+          opt_count > 0 ? cpu_ms / (double)opt_count : 0.0,
+          owner_get_status_kib (pid, "VmRSS:"), last ? "" : ",");
+#undef PERCENTILE
+  fflush (stdout);
+
+  g_array_unref (samples);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GDBusConnection *connection;
+  GError *error = NULL;
+  GtkClipboard *clipboards[2];
+  const gchar *selections[2] = { "clipboard", "primary" };
+  Wait wait = { NULL };
+  const gchar *pid;
+  gint i, j;
+
+  context = g_option_context_new ("PID");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("ingest: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (argc != 2)
+    {
+      g_printerr ("usage: ingest PID\n");
+      return 2;
+    }
+  pid = argv[1];
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (!connection)
+    {
+      g_printerr ("ingest: %s\n", error->message);
+      return 1;
+    }
+
+  wait.loop = g_main_loop_new (NULL, FALSE);
+  g_dbus_connection_signal_subscribe (
+      connection, CLIPMAN_SERVICE_NAME, CLIPMAN_SERVICE_INTERFACE,
+      "ItemAdded", CLIPMAN_SERVICE_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+      on_item_added, &wait, NULL);
+
+  clipboards[0] = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
+  clipboards[1] = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
+
+  printf ("{\n  \"benchmark\": \"ingest\",\n  \"interval_ms\": %d,\n"
+          "  \"scenarios\": [\n",
+          opt_interval);
+
+  for (i = 0; i < 2; i++)
+    for (j = 0; j < N_PAYLOADS; j++)
+      run (clipboards[i], selections[i], j, pid, &wait,
+           i == 1 && j == N_PAYLOADS - 1);
+
+  printf ("  ],\n  \"peak_rss_kib\": %" G_GINT64_FORMAT "\n}\n",
+          owner_get_status_kib (pid, "VmHWM:"));
+
+  g_main_loop_unref (wait.loop);
+  g_object_unref (connection);
+
+  return 0;
+}
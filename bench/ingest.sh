@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# ingest.sh - end-to-end clipboard ingest benchmark for mate-clipman
+#
+# Starts mate-clipman --hidden on a private Xvfb display and session bus
+# with primary selection tracking on, then runs the ingest helper, which
+# owns CLIPBOARD and PRIMARY in turn with text, images and URI lists.  It
+# times every item from the owner change until the history service
+# announces it, covering the selection fetch, item creation and storage
+# commit, and reports CPU time per item and RSS of mate-clipman.
+#
+# usage: ingest.sh MATE_CLIPMAN SCHEMA_DIR INGEST [INGEST_OPTIONS...]
+
+set -u
+
+CLIPMAN=$1
+SCHEMA_DIR=$2
+INGEST=$3
+BENCH=ingest
+BENCH_SETTINGS="use-primary-selection=true"
+
+if [ ! -d /proc/self ]; then
+  echo "$BENCH: /proc not available, skipping" >&2
+  exit 77
+fi
+
+. "$(dirname "$0")/session.sh"
+
+shift 3
+
+"$CLIPMAN" --hidden &
+pid=$!
+wait_for_service $pid || exit 1
+
+"$INGEST" "$@" $pid
+status=$?
+
+kill $pid
+wait $pid 2>/dev/null
+
+exit $status
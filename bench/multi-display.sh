@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# multi-display.sh - per-session memory overhead of mate-clipman
+#
+# Starts N Xvfb displays and compares one mate-clipman --daemon monitoring
+# all of them (--add-display) with one process per display, each on its
+# own session bus.  Memory is the proportional set size, so code pages
+# shared between the separate processes are only counted once.
+#
+# usage: multi-display.sh MATE_CLIPMAN SCHEMA_DIR [SESSIONS...]
+#
+# SESSIONS defaults to "1 4 16".
+
+set -u
+
+CLIPMAN=$1
+SCHEMA_DIR=$2
+shift 2
+SESSIONS=${*:-"1 4 16"}
+SETTLE=${CLIPMAN_SETTLE_S:-3}
+BENCH=multi-display
+
+if [ ! -r /proc/self/smaps_rollup ]; then
+  echo "$BENCH: /proc/PID/smaps_rollup not available, skipping" >&2
+  exit 77
+fi
+
+. "$(dirname "$0")/session.sh"
+
+pss_kib () {
+  awk '/^Pss:/ { print $2 }' /proc/"$1"/smaps_rollup
+}
+
+max=1
+for n in $SESSIONS; do
+  [ "$n" -gt "$max" ] && max=$n
+done
+
+# The first display is the one session.sh started
+displays="$DISPLAY"
+i=1
+while [ $i -lt "$max" ]; do
+  start_xvfb
+  displays="$displays $XVFB_DISPLAY"
+  i=$((i + 1))
+done
+
+for n in $SESSIONS; do
+  these=$(echo $displays | cut -d ' ' -f "1-$n")
+
+  # One process for every display
+  args=""
+  for d in $(echo $these | cut -s -d ' ' -f 2-); do
+    args="$args --add-display $d"
+  done
+  rm -rf "$TMP/data"
+  "$CLIPMAN" --daemon $args &
+  pid=$!
+  wait_for_service $pid || exit 1
+  sleep "$SETTLE"
+  shared=$(pss_kib $pid)
+  kill $pid
+  wait $pid 2>/dev/null
+
+  # One process per display, as with a session each
+  pids=""
+  i=0
+  for d in $these; do
+    i=$((i + 1))
+    DISPLAY=$d XDG_DATA_HOME="$TMP/data$i" dbus-run-session -- \
+      sh -c 'echo $$ >"$0"; exec "$1" --daemon' "$TMP/pid$i" "$CLIPMAN" &
+    pids="$pids $!"
+  done
+  sleep "$SETTLE"
+  separate=0
+  i=0
+  for d in $these; do
+    i=$((i + 1))
+    separate=$((separate + $(pss_kib "$(cat "$TMP/pid$i")")))
+    kill "$(cat "$TMP/pid$i")"
+  done
+  wait $pids 2>/dev/null
+  rm -rf "$TMP"/data*
+
+  printf '{"benchmark": "%s", "sessions": %d, ' "$BENCH" "$n"
+  printf '"shared_kib": %d, "separate_kib": %d, ' "$shared" "$separate"
+  printf '"per_session_shared_kib": %d, "per_session_separate_kib": %d}\n' \
+    $((shared / n)) $((separate / n))
+done
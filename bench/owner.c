@@ -0,0 +1,180 @@
+/*
+ * owner.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "owner.h"
+#include <unistd.h>
+
+/* Payloads are made from SEQ, so the same SEQ gives the same content and
+ * different ones are never folded into one history item */
+
+static void
+get_uris (GtkClipboard *clipboard, GtkSelectionData *selection_data,
+          guint info, gpointer user_data)
+{
+  gtk_selection_data_set_uris (selection_data, user_data);
+}
+
+static void
+clear_uris (GtkClipboard *clipboard, gpointer user_data)
+{
+  g_strfreev (user_data);
+}
+
+static void
+flush (GtkClipboard *clipboard)
+{
+  gdk_display_flush (gtk_clipboard_get_display (clipboard));
+}
+
+/* Each of these takes the selection and returns the payload size */
+gsize
+owner_publish_text (GtkClipboard *clipboard, gsize size, guint seq)
+{
+  GString *text = g_string_sized_new (size);
+
+  g_string_printf (text, "%u ", seq);
+  while (text->len < size)
+    g_string_append (text, "lorem ipsum dolor sit amet\n");
+  g_string_truncate (text, MAX (size, 8));
+
+  gtk_clipboard_set_text (clipboard, text->str, text->len);
+  flush (clipboard);
+
+  size = text->len;
+  g_string_free (text, TRUE);
+
+  return size;
+}
+
+gsize
+owner_publish_image (GtkClipboard *clipboard, gint width, gint height,
+                     guint seq)
+{
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                                      MAX (width, 1), MAX (height, 1));
+  gsize size;
+
+  gdk_pixbuf_fill (pixbuf, 0x3465a4ff);
+  *(guint32 *)gdk_pixbuf_get_pixels (pixbuf) = seq;
+
+  gtk_clipboard_set_image (clipboard, pixbuf);
+  flush (clipboard);
+
+  size = gdk_pixbuf_get_byte_length (pixbuf);
+  g_object_unref (pixbuf);
+
+  return size;
+}
+
+/* N_URIS files whose uri-list adds up to about SIZE bytes, or uses short
+ * names if SIZE is 0 */
+gsize
+owner_publish_uris (GtkClipboard *clipboard, guint n_uris, gsize size,
+                    guint seq)
+{
+  static const GtkTargetEntry uri_target = { "text/uri-list", 0, 0 };
+  gchar **uris = g_new0 (gchar *, MAX (n_uris, 1) + 1);
+  gsize length = size / MAX (n_uris, 1);
+  gsize total = 0;
+  guint i;
+
+  for (i = 0; i < MAX (n_uris, 1); i++)
+    {
+      GString *uri = g_string_new (NULL);
+
+      g_string_printf (uri, "file:///tmp/bench/%u/file-%u", seq, i);
+      while (uri->len + 4 < length)
+        g_string_append_c (uri, 'x');
+      g_string_append (uri, ".txt");
+
+      total += uri->len + 2;
+      uris[i] = g_string_free (uri, FALSE);
+    }
+
+  if (gtk_clipboard_set_with_data (clipboard, &uri_target, 1, get_uris,
+                                   clear_uris, uris))
+    flush (clipboard);
+  else
+    g_strfreev (uris);
+
+  return total;
+}
+
+void
+owner_release (GtkClipboard *clipboard)
+{
+  gtk_clipboard_clear (clipboard);
+  flush (clipboard);
+}
+
+/* CPU time of process PID in milliseconds */
+gint64
+owner_get_cpu_ms (const gchar *pid)
+{
+  gchar *path = g_strdup_printf ("/proc/%s/stat", pid);
+  gchar *contents = NULL;
+  gint64 ticks = 0;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      /* utime and stime are fields 14 and 15, counted after the command
+       * name, which may contain spaces */
+      gchar *p = strrchr (contents, ')');
+      gchar **fields = g_strsplit (p ? p + 2 : contents, " ", 0);
+
+      if (g_strv_length (fields) > 12)
+        ticks = g_ascii_strtoll (fields[11], NULL, 10)
+                + g_ascii_strtoll (fields[12], NULL, 10);
+      g_strfreev (fields);
+    }
+
+  g_free (contents);
+  g_free (path);
+
+  return ticks * 1000 / sysconf (_SC_CLK_TCK);
+}
+
+/* Value of a kB field in /proc/PID/status */
+gint64
+owner_get_status_kib (const gchar *pid, const gchar *field)
+{
+  gchar *path = g_strdup_printf ("/proc/%s/status", pid);
+  gchar *contents = NULL;
+  gint64 kib = 0;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      gchar *line = strstr (contents, field);
+
+      if (line)
+        kib = g_ascii_strtoll (line + strlen (field) + 1, NULL, 10);
+    }
+
+  g_free (contents);
+  g_free (path);
+
+  return kib;
+}
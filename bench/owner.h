@@ -0,0 +1,49 @@
+/*
+ * owner.h
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Clipboard owner with synthetic payloads, shared by the benchmarks that
+ * drive a running mate-clipman */
+
+#ifndef __OWNER_H__
+#define __OWNER_H__
+
+#include "src/clipman.h"
+
+G_BEGIN_DECLS
+
+gsize owner_publish_text (GtkClipboard *clipboard, gsize size, guint seq);
+gsize owner_publish_image (GtkClipboard *clipboard, gint width, gint height,
+                           guint seq);
+gsize owner_publish_uris (GtkClipboard *clipboard, guint n_uris, gsize size,
+                          guint seq);
+void owner_release (GtkClipboard *clipboard);
+
+gint64 owner_get_cpu_ms (const gchar *pid);
+gint64 owner_get_status_kib (const gchar *pid, const gchar *field);
+
+G_END_DECLS
+
+#endif /* __OWNER_H__ */
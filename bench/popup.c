@@ -0,0 +1,403 @@
+/*
+ * popup.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* History popup benchmark. Fills an in-memory storage with N items, shows
+ * them all in a ClipmanHistory popup and measures the time from
+ * clipman_history_show_popup until the first frame and until the window
+ * has focus, from every search of a typed query until its results are
+ * drawn, and the frames of scrolling through the whole list. */
+
+#include "config.h"
+#include "corpus.h"
+#include <stdio.h>
+
+/* Wait at most this long for anything to be drawn, and for the focus,
+ * which may never come without a window manager */
+#define FRAME_TIMEOUT_MS 10000
+#define FOCUS_TIMEOUT_MS 1000
+
+static gchar *opt_sizes = "50,500,5000";
+static gint64 opt_seed = 1;
+static gchar *opt_query = "clipboard";
+
+static const GOptionEntry entries[] = {
+  { "sizes", 'n', 0, G_OPTION_ARG_STRING, &opt_sizes,
+    "Comma-separated history sizes to test", "N,..." },
+  { "seed", 0, 0, G_OPTION_ARG_INT64, &opt_seed,
+    "Seed of the synthetic corpus", "SEED" },
+  { "query", 'q', 0, G_OPTION_ARG_STRING, &opt_query,
+    "Search text to type, one key at a time", "TEXT" },
+  { NULL }
+};
+
+typedef struct
+{
+  GtkWidget *window;
+  GtkAdjustment *vadjustment;
+
+  guint n_draws;
+  gint64 draw_time;
+  guint n_focus;
+  gint64 focus_time;
+
+  gint64 search_time; /* start of the last search, 0 once it is drawn */
+  GArray *keystrokes;
+
+  gint64 frame_time;
+  gint64 paint_time;
+  GArray *frame_work;     /* before-paint to after-paint of each frame */
+  GArray *frame_interval; /* between two painted frames */
+  gboolean scrolling;
+} Popup;
+
+static gboolean
+on_draw (GtkWidget *widget, cairo_t *cr, gpointer user_data)
+{
+  Popup *popup = user_data;
+
+  popup->n_draws++;
+  popup->draw_time = g_get_monotonic_time ();
+
+  if (popup->search_time > 0)
+    {
+      gint64 elapsed = popup->draw_time - popup->search_time;
+
+      g_array_append_val (popup->keystrokes, elapsed);
+      popup->search_time = 0;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+on_focus_in (GtkWidget *widget, GdkEventFocus *event, gpointer user_data)
+{
+  Popup *popup = user_data;
+
+  if (popup->n_focus++ == 0)
+    popup->focus_time = g_get_monotonic_time ();
+
+  return FALSE;
+}
+
+/* Runs before the popup's own handler, so the search is timed from the
+ * moment it starts */
+static gboolean
+on_search_changed_hook (GSignalInvocationHint *ihint, guint n_param_values,
+                        const GValue *param_values, gpointer user_data)
+{
+  Popup *popup = user_data;
+
+  if (gtk_widget_get_toplevel (g_value_get_object (&param_values[0]))
+      == popup->window)
+    popup->search_time = g_get_monotonic_time ();
+
+  return TRUE;
+}
+
+static void
+on_before_paint (GdkFrameClock *clock, gpointer user_data)
+{
+  Popup *popup = user_data;
+
+  popup->frame_time = g_get_monotonic_time ();
+}
+
+static void
+on_after_paint (GdkFrameClock *clock, gpointer user_data)
+{
+  Popup *popup = user_data;
+  gint64 now = g_get_monotonic_time ();
+  gint64 elapsed;
+
+  if (!popup->scrolling)
+    return;
+
+  elapsed = now - popup->frame_time;
+  g_array_append_val (popup->frame_work, elapsed);
+
+  if (popup->paint_time > 0)
+    {
+      elapsed = now - popup->paint_time;
+      g_array_append_val (popup->frame_interval, elapsed);
+    }
+  popup->paint_time = now;
+}
+
+/* Scrolls a quarter page per frame until the end of the list */
+static gboolean
+on_scroll_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+  Popup *popup = user_data;
+  GtkAdjustment *adjustment = popup->vadjustment;
+  gdouble end = gtk_adjustment_get_upper (adjustment)
+                - gtk_adjustment_get_page_size (adjustment);
+  gdouble value = gtk_adjustment_get_value (adjustment);
+
+  if (value >= end)
+    {
+      popup->scrolling = FALSE;
+      return G_SOURCE_REMOVE;
+    }
+
+  gtk_adjustment_set_value (
+      adjustment,
+      MIN (end, value + gtk_adjustment_get_page_size (adjustment) / 4));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+on_wait_timeout (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Runs the main loop until *COUNT grows past START, or TIMEOUT_MS */
+static gboolean
+wait_for (const guint *count, guint start, guint timeout_ms)
+{
+  gboolean timed_out = FALSE;
+  guint timeout_id = g_timeout_add (timeout_ms, on_wait_timeout, &timed_out);
+
+  while (*count <= start && !timed_out)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (!timed_out)
+    g_source_remove (timeout_id);
+
+  return *count > start;
+}
+
+static GtkWidget *
+find_child (GtkWidget *widget, GType type)
+{
+  GList *children, *l;
+  GtkWidget *found = NULL;
+
+  if (G_TYPE_CHECK_INSTANCE_TYPE (widget, type))
+    return widget;
+
+  if (!GTK_IS_CONTAINER (widget))
+    return NULL;
+
+  children = gtk_container_get_children (GTK_CONTAINER (widget));
+  for (l = children; l && !found; l = l->next)
+    found = find_child (l->data, type);
+  g_list_free (children);
+
+  return found;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+print_latencies (const gchar *name, GArray *samples, gboolean last)
+{
+  gint64 *values = (gint64 *)samples->data;
+  guint n = samples->len;
+
+  g_array_sort (samples, compare_int64);
+
+#define PERCENTILE(p) (n > 0 ? values[(n - 1) * (p) / 100] : 0)
+  printf ("      \"%s\": {\"count\": %u, \"p50_us\": %" G_GINT64_FORMAT
+          ", \"p90_us\": %" G_GINT64_FORMAT ", \"p99_us\": %" G_GINT64_FORMAT
+          ", \"max_us\": %" G_GINT64_FORMAT "}%s\n",
+          name, n, PERCENTILE (50), PERCENTILE (90), PERCENTILE (99),
+          n > 0 ? values[n - 1] : 0, last ? "" : ",");
+#undef PERCENTILE
+}
+
+static void
+print_time (const gchar *name, gint64 start, gint64 end)
+{
+  if (end > 0)
+    printf ("      \"%s\": %" G_GINT64_FORMAT ",\n", name, end - start);
+  else
+    printf ("      \"%s\": null,\n", name);
+}
+
+static gboolean
+run (GSettings *settings, guint n_items, CorpusMix mix, gboolean last)
+{
+  ClipmanStorage *storage;
+  ClipmanHistory *history;
+  GdkFrameClock *clock;
+  GtkWidget *entry;
+  Popup popup = { NULL };
+  gulong hook_id;
+  gint64 start;
+  guint i;
+
+  storage = clipman_storage_new_for_path (":memory:", NULL);
+  for (i = 0; i < n_items; i++)
+    {
+      ClipmanItem *item = corpus_make_item (opt_seed, i, mix);
+
+      clipman_storage_add_item (storage, item);
+      g_object_unref (item);
+    }
+
+  /* Show every item, as a user with a long history would see it */
+  g_settings_set_int (settings, "history-size", n_items);
+  history = clipman_history_new (storage, settings);
+
+  popup.window = GTK_WIDGET (history);
+  popup.keystrokes = g_array_new (FALSE, FALSE, sizeof (gint64));
+  popup.frame_work = g_array_new (FALSE, FALSE, sizeof (gint64));
+  popup.frame_interval = g_array_new (FALSE, FALSE, sizeof (gint64));
+  g_signal_connect_after (history, "draw", G_CALLBACK (on_draw), &popup);
+  g_signal_connect (history, "focus-in-event", G_CALLBACK (on_focus_in),
+                    &popup);
+
+  /* Let the storage's idle work settle before timing anything */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  start = g_get_monotonic_time ();
+  clipman_history_show_popup (history);
+  if (!wait_for (&popup.n_draws, 0, FRAME_TIMEOUT_MS))
+    {
+      g_printerr ("popup: nothing drawn for %u items\n", n_items);
+      return FALSE;
+    }
+  wait_for (&popup.n_focus, 0, FOCUS_TIMEOUT_MS);
+
+  printf ("    {\n      \"items\": %u,\n      \"corpus\": \"%s\",\n",
+          n_items, mix == CORPUS_IMAGES ? "images" : "mixed");
+  print_time ("first_frame_us", start, popup.draw_time);
+  print_time ("focus_us", start, popup.focus_time);
+
+  /* Type the query one key at a time, waiting for each search */
+  entry = find_child (popup.window, GTK_TYPE_SEARCH_ENTRY);
+  hook_id = g_signal_add_emission_hook (
+      g_signal_lookup ("search-changed", GTK_TYPE_SEARCH_ENTRY), 0,
+      on_search_changed_hook, &popup, NULL);
+
+  for (i = 1; i <= strlen (opt_query); i++)
+    {
+      gchar *text = g_strndup (opt_query, i);
+
+      gtk_entry_set_text (GTK_ENTRY (entry), text);
+      wait_for (&popup.keystrokes->len, i - 1, FRAME_TIMEOUT_MS);
+      g_free (text);
+    }
+
+  g_signal_remove_emission_hook (
+      g_signal_lookup ("search-changed", GTK_TYPE_SEARCH_ENTRY), hook_id);
+  print_latencies ("keystroke", popup.keystrokes, FALSE);
+
+  /* Back to the full list, then scroll it from top to bottom */
+  clipman_history_refresh (history);
+  wait_for (&popup.n_draws, popup.n_draws, FRAME_TIMEOUT_MS);
+
+  popup.vadjustment = gtk_scrolled_window_get_vadjustment (
+      GTK_SCROLLED_WINDOW (find_child (popup.window,
+                                       GTK_TYPE_SCROLLED_WINDOW)));
+  clock = gtk_widget_get_frame_clock (popup.window);
+  g_signal_connect (clock, "before-paint", G_CALLBACK (on_before_paint),
+                    &popup);
+  g_signal_connect (clock, "after-paint", G_CALLBACK (on_after_paint),
+                    &popup);
+
+  popup.scrolling = TRUE;
+  gtk_widget_add_tick_callback (popup.window, on_scroll_tick, &popup, NULL);
+  while (popup.scrolling)
+    g_main_context_iteration (NULL, TRUE);
+
+  print_latencies ("scroll_frame_work", popup.frame_work, FALSE);
+  print_latencies ("scroll_frame_interval", popup.frame_interval, TRUE);
+  printf ("    }%s\n", last ? "" : ",");
+  fflush (stdout);
+
+  g_signal_handlers_disconnect_by_data (clock, &popup);
+  gtk_widget_destroy (popup.window);
+  g_object_unref (storage);
+  g_array_unref (popup.keystrokes);
+  g_array_unref (popup.frame_work);
+  g_array_unref (popup.frame_interval);
+
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GSettings *settings;
+  GError *error = NULL;
+  gchar **sizes;
+  gboolean ok = TRUE;
+  guint i;
+  gint mix;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("popup: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  settings = g_settings_new ("org.mate.clipman");
+  g_settings_set_boolean (settings, "show-preview", TRUE);
+
+  sizes = g_strsplit (opt_sizes, ",", -1);
+
+  printf ("{\n  \"benchmark\": \"popup\",\n  \"seed\": %" G_GINT64_FORMAT
+          ",\n  \"runs\": [\n",
+          opt_seed);
+
+  for (mix = CORPUS_MIXED; ok && mix <= CORPUS_IMAGES; mix++)
+    for (i = 0; ok && sizes[i]; i++)
+      {
+        guint n_items = (guint)g_ascii_strtoull (sizes[i], NULL, 10);
+
+        if (n_items > 0)
+          ok = run (settings, n_items, mix,
+                    mix == CORPUS_IMAGES && sizes[i + 1] == NULL);
+      }
+
+  printf ("  ]\n}\n");
+
+  g_strfreev (sizes);
+  g_object_unref (settings);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+#
+# popup.sh - history popup latency benchmark for mate-clipman
+#
+# Runs the popup benchmark on a private Xvfb display with the clipman
+# schema compiled into a temporary directory.  The benchmark itself fills
+# the history in memory, so no mate-clipman process is involved.
+#
+# usage: popup.sh SCHEMA_DIR POPUP [POPUP_OPTIONS...]
+
+set -u
+
+SCHEMA_DIR=$1
+POPUP=$2
+BENCH=popup
+
+. "$(dirname "$0")/session.sh"
+
+shift 2
+
+"$POPUP" "$@"
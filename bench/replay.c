@@ -0,0 +1,310 @@
+/*
+ * replay.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Replays a trace written by mate-clipman --record-trace against the
+ * mate-clipman process PID. Every owner change is played at its recorded
+ * time with a synthetic payload of the same type and size; copies that
+ * had the same hash get the same payload, so repeats stay repeats.
+ * Prints how many items were stored, their latency, how far playback
+ * fell behind the trace, and the CPU time and RSS of mate-clipman. */
+
+#include "config.h"
+#include "owner.h"
+#include <stdio.h>
+
+/* Time allowed after the last event for its item to be stored */
+#define DRAIN_TIMEOUT_MS 5000
+
+static gdouble opt_speed = 1.0;
+
+static const GOptionEntry entries[] = {
+  { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &opt_speed,
+    "Play the trace this many times faster", "FACTOR" },
+  { NULL }
+};
+
+typedef struct
+{
+  gint64 time;
+  gboolean primary;
+  gchar type[8];
+  gsize size;
+  gint width;
+  gint height;
+  guint count;
+  gchar hash[17];
+} Event;
+
+typedef struct
+{
+  GMainLoop *loop;
+  guint n_stored;
+  gint64 published_time; /* of an event whose item is awaited, or 0 */
+  GArray *latencies;
+} Replay;
+
+static GArray *
+read_trace (const gchar *path, GError **error)
+{
+  GArray *events;
+  gchar *contents;
+  gchar **lines;
+  guint i;
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return NULL;
+
+  events = g_array_new (FALSE, TRUE, sizeof (Event));
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i]; i++)
+    {
+      Event event = { 0 };
+      gchar selection[16];
+
+      if (lines[i][0] == '#' || lines[i][0] == '\0')
+        continue;
+
+      if (sscanf (lines[i],
+                  "%" G_GINT64_FORMAT "\t%15s\t%7s\t%" G_GSIZE_FORMAT
+                  "\t%d\t%d\t%u\t%16s",
+                  &event.time, selection, event.type, &event.size,
+                  &event.width, &event.height, &event.count, event.hash)
+          != 8)
+        {
+          g_printerr ("replay: %s:%u: malformed event\n", path, i + 1);
+          continue;
+        }
+
+      event.primary = g_str_equal (selection, "primary");
+      g_array_append_val (events, event);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return events;
+}
+
+static void
+on_item_added (GDBusConnection *connection, const gchar *sender_name,
+               const gchar *object_path, const gchar *interface_name,
+               const gchar *signal_name, GVariant *parameters,
+               gpointer user_data)
+{
+  Replay *replay = user_data;
+
+  replay->n_stored++;
+
+  /* Only an item stored before the next event can be told apart */
+  if (replay->published_time > 0)
+    {
+      gint64 elapsed = g_get_monotonic_time () - replay->published_time;
+
+      g_array_append_val (replay->latencies, elapsed);
+      replay->published_time = 0;
+    }
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Runs the main loop, so the selections are served, until TIME */
+static void
+run_until (Replay *replay, gint64 time)
+{
+  gint64 delay = time - g_get_monotonic_time ();
+
+  if (delay <= 0)
+    return;
+
+  g_timeout_add (delay / 1000, on_timeout, replay->loop);
+  g_main_loop_run (replay->loop);
+}
+
+static void
+publish (Event *event, guint seq)
+{
+  GtkClipboard *clipboard = gtk_clipboard_get (
+      event->primary ? GDK_SELECTION_PRIMARY : GDK_SELECTION_CLIPBOARD);
+
+  if (g_str_equal (event->type, "text"))
+    owner_publish_text (clipboard, event->size, seq);
+  else if (g_str_equal (event->type, "image"))
+    owner_publish_image (clipboard, event->width, event->height, seq);
+  else if (g_str_equal (event->type, "files"))
+    owner_publish_uris (clipboard, event->count, event->size, seq);
+  else
+    owner_release (clipboard);
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+print_latencies (const gchar *name, GArray *samples)
+{
+  gint64 *values = (gint64 *)samples->data;
+  guint n = samples->len;
+
+  g_array_sort (samples, compare_int64);
+
+#define PERCENTILE(p) (n > 0 ? values[(n - 1) * (p) / 100] : 0)
+  printf ("  \"%s\": {\"count\": %u, \"p50_us\": %" G_GINT64_FORMAT
+          ", \"p90_us\": %" G_GINT64_FORMAT ", \"p99_us\": %" G_GINT64_FORMAT
+          ", \"max_us\": %" G_GINT64_FORMAT "},\n",
+          name, n, PERCENTILE (50), PERCENTILE (90), PERCENTILE (99),
+          n > 0 ? values[n - 1] : 0);
+#undef PERCENTILE
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GDBusConnection *connection;
+  GError *error = NULL;
+  GHashTable *payloads;
+  GArray *events;
+  GArray *lateness;
+  Replay replay = { NULL };
+  const gchar *pid;
+  guint n_expected = 0;
+  gint64 start;
+  gint64 cpu_ms;
+  guint i;
+
+  context = g_option_context_new ("TRACE PID");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("replay: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (argc != 3 || opt_speed <= 0)
+    {
+      g_printerr ("usage: replay [--speed FACTOR] TRACE PID\n");
+      return 2;
+    }
+  pid = argv[2];
+
+  events = read_trace (argv[1], &error);
+  connection = events ? g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error)
+                      : NULL;
+  if (!connection)
+    {
+      g_printerr ("replay: %s\n", error->message);
+      return 1;
+    }
+
+  replay.loop = g_main_loop_new (NULL, FALSE);
+  replay.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  g_dbus_connection_signal_subscribe (
+      connection, CLIPMAN_SERVICE_NAME, CLIPMAN_SERVICE_INTERFACE,
+      "ItemAdded", CLIPMAN_SERVICE_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+      on_item_added, &replay, NULL);
+
+  /* The payload of each hash, numbered in order of first appearance */
+  payloads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  lateness = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  cpu_ms = owner_get_cpu_ms (pid);
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < events->len; i++)
+    {
+      Event *event = &g_array_index (events, Event, i);
+      Event *first = &g_array_index (events, Event, 0);
+      gint64 time = start + (event->time - first->time) / opt_speed;
+      gpointer seq;
+      gboolean repeat;
+      gint64 late;
+
+      run_until (&replay, time);
+
+      repeat = g_hash_table_lookup_extended (payloads, event->hash, NULL,
+                                             &seq);
+      if (!repeat)
+        {
+          seq = GUINT_TO_POINTER (g_hash_table_size (payloads) + 1);
+          g_hash_table_insert (payloads, g_strdup (event->hash), seq);
+        }
+
+      late = MAX (0, g_get_monotonic_time () - time);
+      g_array_append_val (lateness, late);
+
+      /* Repeats and releases don't add an item */
+      replay.published_time = 0;
+      if (!repeat && !g_str_equal (event->type, "empty"))
+        {
+          replay.published_time = g_get_monotonic_time ();
+          n_expected++;
+        }
+
+      publish (event, GPOINTER_TO_UINT (seq));
+    }
+
+  /* Give the last items time to be stored */
+  for (i = 0; i < DRAIN_TIMEOUT_MS / 100 && replay.n_stored < n_expected;
+       i++)
+    run_until (&replay, g_get_monotonic_time () + 100 * 1000);
+
+  cpu_ms = owner_get_cpu_ms (pid) - cpu_ms;
+
+  printf ("{\n  \"benchmark\": \"replay\",\n  \"trace\": \"%s\",\n"
+          "  \"speed\": %.2f,\n  \"events\": %u,\n  \"expected\": %u,\n"
+          "  \"stored\": %u,\n",
+          argv[1], opt_speed, events->len, n_expected, replay.n_stored);
+  print_latencies ("latency", replay.latencies);
+  print_latencies ("lateness", lateness);
+  printf ("  \"cpu_ms\": %" G_GINT64_FORMAT ",\n  \"rss_kib\": %"
+          G_GINT64_FORMAT ",\n  \"peak_rss_kib\": %" G_GINT64_FORMAT "\n}\n",
+          cpu_ms, owner_get_status_kib (pid, "VmRSS:"),
+          owner_get_status_kib (pid, "VmHWM:"));
+
+  g_hash_table_unref (payloads);
+  g_array_unref (lateness);
+  g_array_unref (replay.latencies);
+  g_array_unref (events);
+  g_main_loop_unref (replay.loop);
+  g_object_unref (connection);
+
+  return replay.n_stored < n_expected ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# replay.sh - replays a recorded clipboard trace against mate-clipman
+#
+# Starts mate-clipman --hidden on a private Xvfb display and session bus
+# with primary selection tracking on, and plays TRACE back with synthetic
+# payloads of the recorded sizes.  Traces are recorded with
+# mate-clipman --record-trace FILE and hold no clipboard content.
+#
+# usage: replay.sh MATE_CLIPMAN SCHEMA_DIR REPLAY TRACE [REPLAY_OPTIONS...]
+
+set -u
+
+CLIPMAN=$1
+SCHEMA_DIR=$2
+REPLAY=$3
+TRACE=$4
+BENCH=replay
+BENCH_SETTINGS="use-primary-selection=true"
+
+if [ ! -d /proc/self ]; then
+  echo "$BENCH: /proc not available, skipping" >&2
+  exit 77
+fi
+
+. "$(dirname "$0")/session.sh"
+
+shift 4
+
+"$CLIPMAN" --hidden &
+pid=$!
+wait_for_service $pid || exit 1
+
+"$REPLAY" "$@" "$TRACE" $pid
+status=$?
+
+kill $pid
+wait $pid 2>/dev/null
+
+exit $status
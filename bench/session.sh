@@ -0,0 +1,69 @@
+# session.sh - shared setup for the mate-clipman benchmarks
+#
+# Sourced by the benchmark scripts after they set BENCH (their name) and
+# SCHEMA_DIR, and optionally BENCH_TOOLS (extra programs they need) and
+# BENCH_SETTINGS (lines of "key=value" overriding the schema defaults).
+# Re-runs the script inside a private session bus, so D-Bus activation
+# and other instances on the user's session can't interfere, starts an
+# Xvfb display and keeps GSettings and the database in the temporary
+# directory $TMP.
+
+# Exit code 77 marks the benchmark as skipped
+for tool in Xvfb dbus-run-session gdbus glib-compile-schemas \
+            ${BENCH_TOOLS:-}; do
+  if ! command -v "$tool" >/dev/null 2>&1; then
+    echo "$BENCH: $tool not found, skipping" >&2
+    exit 77
+  fi
+done
+
+if [ -z "${CLIPMAN_BENCH_SESSION:-}" ]; then
+  CLIPMAN_BENCH_SESSION=1 exec dbus-run-session -- "$0" "$@"
+fi
+
+TMP=$(mktemp -d)
+XVFB_PIDS=""
+trap 'kill $XVFB_PIDS 2>/dev/null; rm -rf "$TMP"' EXIT
+
+# The memory backend can't be changed from outside, so settings other than
+# the defaults are compiled in as overrides
+cp "$SCHEMA_DIR"/*.gschema.xml "$TMP" || exit 1
+if [ -n "${BENCH_SETTINGS:-}" ]; then
+  printf '[org.mate.clipman]\n%s\n' "$BENCH_SETTINGS" \
+    >"$TMP/bench.gschema.override"
+fi
+glib-compile-schemas "$TMP" || exit 1
+
+# Starts another Xvfb server and sets XVFB_DISPLAY to its name
+start_xvfb () {
+  rm -f "$TMP/display"
+  Xvfb -displayfd 3 -nolisten tcp 3>"$TMP/display" 2>/dev/null &
+  XVFB_PIDS="$XVFB_PIDS $!"
+  while [ ! -s "$TMP/display" ]; do
+    sleep 0.01
+  done
+  XVFB_DISPLAY=":$(cat "$TMP/display")"
+}
+
+start_xvfb
+export DISPLAY="$XVFB_DISPLAY"
+export GSETTINGS_SCHEMA_DIR="$TMP"
+export GSETTINGS_BACKEND=memory
+export XDG_DATA_HOME="$TMP/data"
+export NO_AT_BRIDGE=1
+
+now_ms () {
+  echo $(($(date +%s%N) / 1000000))
+}
+
+# Waits until the history service answers, failing if process $1 exits
+wait_for_service () {
+  until gdbus call --session --dest org.mate.clipman \
+          --object-path /org/mate/clipman \
+          --method org.mate.Clipman.History.List 0 1 >/dev/null 2>&1; do
+    if ! kill -0 "$1" 2>/dev/null; then
+      echo "$BENCH: mate-clipman exited early" >&2
+      return 1
+    fi
+  done
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# startup.sh - cold start benchmark for mate-clipman
+#
+# Starts mate-clipman --daemon on a private Xvfb display and session bus,
+# and measures how long it takes until the history service answers on
+# D-Bus.  The first run creates the database and is reported separately;
+# the median of the remaining runs must stay within the budget.
+#
+# usage: startup.sh MATE_CLIPMAN SCHEMA_DIR [RUNS]
+#
+# CLIPMAN_STARTUP_BUDGET_MS overrides the budget (default 500 ms).
+
+set -u
+
+CLIPMAN=$1
+SCHEMA_DIR=$2
+RUNS=${3:-7}
+BUDGET_MS=${CLIPMAN_STARTUP_BUDGET_MS:-500}
+BENCH=startup
+
+. "$(dirname "$0")/session.sh"
+
+run_once () {
+  start=$(now_ms)
+  "$CLIPMAN" --daemon &
+  pid=$!
+
+  wait_for_service $pid || exit 1
+
+  echo $(($(now_ms) - start))
+  kill $pid
+  wait $pid 2>/dev/null
+}
+
+first=$(run_once) || exit 1
+times=""
+i=1
+while [ $i -lt "$RUNS" ]; do
+  t=$(run_once) || exit 1
+  times="$times $t"
+  i=$((i + 1))
+done
+
+sorted=$(echo $times | tr ' ' '\n' | sort -n)
+count=$(echo "$sorted" | wc -l)
+median=$(echo "$sorted" | sed -n "$(((count + 1) / 2))p")
+max=$(echo "$sorted" | tail -n 1)
+
+printf '{"benchmark": "startup", "runs": %d, "first_ms": %d, ' \
+  "$count" "$first"
+printf '"median_ms": %d, "max_ms": %d, "budget_ms": %d}\n' \
+  "$median" "$max" "$BUDGET_MS"
+
+if [ "$median" -gt "$BUDGET_MS" ]; then
+  echo "startup: median ${median} ms exceeds budget of ${BUDGET_MS} ms" >&2
+  exit 1
+fi
@@ -0,0 +1,266 @@
+/*
+ * storage.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ *
+ * Copyright 2025 Kerem Soke
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Storage microbenchmark. Fills a fresh ClipmanStorage with a synthetic
+ * corpus of N items and times add, bump (adding an item again), remove,
+ * get_items, search and clear. Prints one JSON object with latency
+ * percentiles in microseconds for every N. With --no-tune the database
+ * keeps SQLite's defaults, for comparison with the tuned run. */
+
+#include "config.h"
+#include "corpus.h"
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+/* Items the history popup asks for, the default history-size */
+#define PAGE_SIZE 50
+
+static gchar *opt_sizes = "1000,10000,100000";
+static gint opt_samples = 1000;
+static gint64 opt_seed = 1;
+static gboolean opt_memory;
+static gboolean opt_no_tune;
+
+static const GOptionEntry entries[] = {
+  { "sizes", 'n', 0, G_OPTION_ARG_STRING, &opt_sizes,
+    "Comma-separated history sizes to test", "N,..." },
+  { "samples", 's', 0, G_OPTION_ARG_INT, &opt_samples,
+    "Operations to time for bump, remove, get_items and search", "N" },
+  { "seed", 0, 0, G_OPTION_ARG_INT64, &opt_seed,
+    "Seed of the synthetic corpus", "SEED" },
+  { "memory", 'm', 0, G_OPTION_ARG_NONE, &opt_memory,
+    "Keep the database in memory instead of a temporary file", NULL },
+  { "no-tune", 0, 0, G_OPTION_ARG_NONE, &opt_no_tune,
+    "Use SQLite's default cache and mmap sizes", NULL },
+  { NULL }
+};
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+record (GArray *samples, gint64 start)
+{
+  gint64 elapsed = g_get_monotonic_time () - start;
+
+  g_array_append_val (samples, elapsed);
+}
+
+static void
+print_latencies (const gchar *name, GArray *samples, gboolean last)
+{
+  gint64 *values = (gint64 *)samples->data;
+  guint n = samples->len;
+
+  g_array_sort (samples, compare_int64);
+
+#define PERCENTILE(p) (n > 0 ? values[(n - 1) * (p) / 100] : 0)
+  printf ("      \"%s\": {\"count\": %u, \"p50_us\": %" G_GINT64_FORMAT
+          ", \"p90_us\": %" G_GINT64_FORMAT ", \"p99_us\": %" G_GINT64_FORMAT
+          ", \"max_us\": %" G_GINT64_FORMAT "}%s\n",
+          name, n, PERCENTILE (50), PERCENTILE (90), PERCENTILE (99),
+          n > 0 ? values[n - 1] : 0, last ? "" : ",");
+#undef PERCENTILE
+
+  g_array_set_size (samples, 0);
+}
+
+static void
+remove_database (const gchar *dir)
+{
+  GDir *d = g_dir_open (dir, 0, NULL);
+  const gchar *name;
+
+  while (d && (name = g_dir_read_name (d)))
+    {
+      gchar *path = g_build_filename (dir, name, NULL);
+
+      g_remove (path);
+      g_free (path);
+    }
+
+  if (d)
+    g_dir_close (d);
+}
+
+static gboolean
+run (guint n_items, const gchar *dir, gboolean last)
+{
+  ClipmanStorage *storage;
+  GArray *samples = g_array_new (FALSE, FALSE, sizeof (gint64));
+  gint64 *ids = g_new (gint64, n_items);
+  gchar *path;
+  gint64 start;
+  GRand *rand;
+  guint i;
+
+  path = opt_memory ? g_strdup (":memory:")
+                    : g_build_filename (dir, "history.db", NULL);
+  storage = clipman_storage_new_for_path (path, NULL);
+  clipman_storage_set_autotune (storage, !opt_no_tune);
+  rand = g_rand_new_with_seed ((guint32)opt_seed);
+
+  printf ("    {\n      \"items\": %u,\n", n_items);
+
+  for (i = 0; i < n_items; i++)
+    {
+      ClipmanItem *item = corpus_make_item (opt_seed, i, CORPUS_MIXED);
+
+      start = g_get_monotonic_time ();
+      if (!clipman_storage_add_item (storage, item))
+        {
+          g_printerr ("storage: failed to add item %u\n", i);
+          return FALSE;
+        }
+      record (samples, start);
+
+      ids[i] = clipman_item_get_id (item);
+      g_object_unref (item);
+    }
+  print_latencies ("add", samples, FALSE);
+
+  for (i = 0; i < (guint)opt_samples; i++)
+    {
+      GList *items;
+
+      start = g_get_monotonic_time ();
+      items = clipman_storage_get_items (storage, PAGE_SIZE);
+      record (samples, start);
+      g_list_free_full (items, g_object_unref);
+    }
+  print_latencies ("get_items", samples, FALSE);
+
+  for (i = 0; i < (guint)opt_samples; i++)
+    {
+      const gchar *query = corpus_word (rand);
+      GList *items;
+
+      start = g_get_monotonic_time ();
+      items = clipman_storage_search (storage, query, PAGE_SIZE);
+      record (samples, start);
+      g_list_free_full (items, g_object_unref);
+    }
+  print_latencies ("search", samples, FALSE);
+
+  for (i = 0; i < (guint)opt_samples; i++)
+    {
+      guint index = g_rand_int_range (rand, 0, n_items);
+      ClipmanItem *item = corpus_make_item (opt_seed, index, CORPUS_MIXED);
+
+      start = g_get_monotonic_time ();
+      clipman_storage_add_item (storage, item);
+      record (samples, start);
+      g_object_unref (item);
+    }
+  print_latencies ("bump", samples, FALSE);
+
+  for (i = 0; i < MIN ((guint)opt_samples, n_items / 2); i++)
+    {
+      guint index = g_rand_int_range (rand, 0, n_items - i);
+
+      start = g_get_monotonic_time ();
+      clipman_storage_remove_item (storage, ids[index]);
+      record (samples, start);
+      ids[index] = ids[n_items - i - 1];
+    }
+  print_latencies ("remove", samples, FALSE);
+
+  start = g_get_monotonic_time ();
+  clipman_storage_clear (storage);
+  record (samples, start);
+  print_latencies ("clear", samples, TRUE);
+
+  printf ("    }%s\n", last ? "" : ",");
+  fflush (stdout);
+
+  g_object_unref (storage);
+  if (!opt_memory)
+    remove_database (dir);
+
+  g_rand_free (rand);
+  g_free (path);
+  g_free (ids);
+  g_array_unref (samples);
+
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gchar **sizes;
+  gchar *dir;
+  gboolean ok = TRUE;
+  guint i;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("storage: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  dir = g_dir_make_tmp ("clipman-bench-XXXXXX", &error);
+  if (!dir)
+    {
+      g_printerr ("storage: %s\n", error->message);
+      return 1;
+    }
+
+  sizes = g_strsplit (opt_sizes, ",", -1);
+
+  printf ("{\n  \"benchmark\": \"storage\",\n  \"seed\": %" G_GINT64_FORMAT
+          ",\n  \"database\": \"%s\",\n  \"tuned\": %s,\n"
+          "  \"runs\": [\n",
+          opt_seed, opt_memory ? "memory" : "file",
+          opt_no_tune ? "false" : "true");
+
+  for (i = 0; ok && sizes[i]; i++)
+    {
+      guint n_items = (guint)g_ascii_strtoull (sizes[i], NULL, 10);
+
+      if (n_items > 0)
+        ok = run (n_items, dir, sizes[i + 1] == NULL);
+    }
+
+  printf ("  ]\n}\n");
+
+  g_strfreev (sizes);
+  g_rmdir (dir);
+  g_free (dir);
+
+  return ok ? 0 : 1;
+}
@@ -26,6 +26,27 @@
 
 #include "clipman.h"
 #include "config.h"
+#include <glib-unix.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef HAVE_MALLOC_TRIM
+#  include <malloc.h>
+#endif
+
+/* Seconds the popup must stay hidden and the clipboard quiet before
+ * memory is given back */
+#define TRIM_DELAY 60
+
+/* How much memory to give back, from an idle trim up to what a critical
+ * memory warning asks for */
+typedef enum
+{
+  SHED_IDLE,
+  SHED_CACHES,
+  SHED_ALL
+} ShedLevel;
 
 struct _ClipmanApp
 {
@@ -33,31 +54,177 @@ struct _ClipmanApp
 
   GSettings *settings;
   ClipmanStorage *storage;
-  ClipmanManager *manager;
+  GPtrArray *managers;
+  GPtrArray *storages; /* of each manager, the first one is storage */
+  GPtrArray *displays; /* opened for --add-display */
   ClipmanHistory *history;
   ClipmanPreferences *preferences;
+  ClipmanService *service;
+  GCancellable *cancellable;
+  guint trim_id;
+  guint sigterm_id;
+  guint sigusr1_id;
+#if GLIB_CHECK_VERSION(2, 64, 0)
+  GMemoryMonitor *memory_monitor;
+#endif
 
   GtkStatusIcon *status_icon;
   GtkWidget *menu;
 
   gboolean start_hidden;
+  gboolean daemon;
+  gboolean ephemeral;
+  gchar *ephemeral_sync_dir;
+  gchar **extra_displays;
+  gchar *trace_path;
+  GOutputStream *trace;
 };
 
 G_DEFINE_TYPE (ClipmanApp, clipman_app, GTK_TYPE_APPLICATION)
 
+static void
+on_backup_settings_changed (GSettings *settings, const gchar *key,
+                            gpointer user_data)
+{
+  ClipmanApp *self = CLIPMAN_APP (user_data);
+  gint interval = g_settings_get_int (settings, "backup-interval");
+  gint count = g_settings_get_int (settings, "backup-count");
+
+  for (guint i = 0; i < self->storages->len; i++)
+    clipman_storage_set_backup_policy (g_ptr_array_index (self->storages, i),
+                                       MAX (interval, 0) * 60,
+                                       MAX (count, 0));
+}
+
+static glong
+get_rss_kib (void)
+{
+  gchar *contents = NULL;
+  gulong pages = 0;
+
+  if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    sscanf (contents, "%*lu %lu", &pages);
+  g_free (contents);
+
+  return pages * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static void
+shed_memory (ClipmanApp *self, ShedLevel level)
+{
+  gboolean hidden;
+  glong rss = get_rss_kib ();
+
+  /* Everything dropped here is rebuilt when it is needed again */
+  hidden = self->history
+           && !gtk_widget_get_visible (GTK_WIDGET (self->history));
+
+  if (hidden && level == SHED_ALL)
+    {
+      g_signal_handlers_disconnect_by_data (self->history, self);
+      gtk_widget_destroy (GTK_WIDGET (self->history));
+      self->history = NULL;
+    }
+  else if (hidden)
+    {
+      /* Hidden rows hold the items and their decoded pixbufs */
+      clipman_history_release_rows (self->history);
+    }
+
+  for (guint i = 0; self->storages && i < self->storages->len; i++)
+    {
+      ClipmanStorage *storage = g_ptr_array_index (self->storages, i);
+
+      if (level >= SHED_CACHES)
+        clipman_storage_shrink_cache (storage);
+      else
+        clipman_storage_release_memory (storage);
+    }
+
+#ifdef HAVE_MALLOC_TRIM
+  malloc_trim (0);
+#endif
+
+  g_debug ("Released memory (level %d): RSS %ld KiB -> %ld KiB", level, rss,
+           get_rss_kib ());
+}
+
+static gboolean
+on_trim_timeout (gpointer user_data)
+{
+  ClipmanApp *self = CLIPMAN_APP (user_data);
+
+  self->trim_id = 0;
+
+  if (self->history && gtk_widget_get_visible (GTK_WIDGET (self->history)))
+    return G_SOURCE_REMOVE;
+
+  shed_memory (self, SHED_IDLE);
+
+  return G_SOURCE_REMOVE;
+}
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+static void
+on_low_memory_warning (GMemoryMonitor *monitor,
+                       GMemoryMonitorWarningLevel level, gpointer user_data)
+{
+  ClipmanApp *self = CLIPMAN_APP (user_data);
+
+  if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_CRITICAL)
+    shed_memory (self, SHED_ALL);
+  else if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_MEDIUM)
+    shed_memory (self, SHED_CACHES);
+  else
+    shed_memory (self, SHED_IDLE);
+}
+#endif
+
+static void
+schedule_trim (ClipmanApp *self)
+{
+  /* Every clipboard change starts the wait over */
+  if (self->trim_id > 0)
+    g_source_remove (self->trim_id);
+
+  self->trim_id = g_timeout_add_seconds (TRIM_DELAY, on_trim_timeout, self);
+}
+
+static void
+on_history_hidden (GtkWidget *widget, gpointer user_data)
+{
+  schedule_trim (CLIPMAN_APP (user_data));
+}
+
+/* Each display keeps a history of its own */
+static ClipmanStorage *
+get_manager_storage (ClipmanApp *self, ClipmanManager *manager)
+{
+  for (guint i = 0; i < self->managers->len; i++)
+    if (g_ptr_array_index (self->managers, i) == manager)
+      return g_ptr_array_index (self->storages, i);
+
+  return self->storage;
+}
+
 static void
 on_item_received (ClipmanManager *manager, ClipmanItem *item,
                   gpointer user_data)
 {
   ClipmanApp *self = CLIPMAN_APP (user_data);
 
-  clipman_storage_add_item (self->storage, item);
+  schedule_trim (self);
+
+  clipman_storage_add_item (get_manager_storage (self, manager), item);
 
   /* Sync selections if enabled */
   if (g_settings_get_boolean (self->settings, "sync-selections"))
     {
-      GtkClipboard *clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
-      GtkClipboard *primary = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
+      GdkDisplay *display = clipman_manager_get_display (manager);
+      GtkClipboard *clipboard
+          = gtk_clipboard_get_for_display (display, GDK_SELECTION_CLIPBOARD);
+      GtkClipboard *primary
+          = gtk_clipboard_get_for_display (display, GDK_SELECTION_PRIMARY);
       ClipmanSource source = clipman_item_get_source (item);
 
       if (source == CLIPMAN_SOURCE_CLIPBOARD)
@@ -80,16 +247,20 @@ on_clipboard_empty (ClipmanManager *manager, gint source, gpointer user_data)
     return;
 
   /* Restore last item to clipboard */
-  GList *items = clipman_storage_get_items (self->storage, 1);
+  GList *items
+      = clipman_storage_get_items (get_manager_storage (self, manager), 1);
   if (items)
     {
       ClipmanItem *item = items->data;
+      GdkDisplay *display = clipman_manager_get_display (manager);
       GtkClipboard *clipboard;
 
       if (source == CLIPMAN_SOURCE_PRIMARY)
-        clipboard = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
+        clipboard
+            = gtk_clipboard_get_for_display (display, GDK_SELECTION_PRIMARY);
       else
-        clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
+        clipboard = gtk_clipboard_get_for_display (display,
+                                                   GDK_SELECTION_CLIPBOARD);
 
       clipman_item_to_clipboard (item, clipboard);
       g_list_free_full (items, g_object_unref);
@@ -97,10 +268,8 @@ on_clipboard_empty (ClipmanManager *manager, gint source, gpointer user_data)
 }
 
 static void
-on_item_selected (ClipmanHistory *history, ClipmanItem *item,
-                  gpointer user_data)
+select_item (ClipmanApp *self, ClipmanItem *item)
 {
-  ClipmanApp *self = CLIPMAN_APP (user_data);
   GtkClipboard *clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
 
   clipman_item_to_clipboard (item, clipboard);
@@ -109,11 +278,28 @@ on_item_selected (ClipmanHistory *history, ClipmanItem *item,
   clipman_storage_add_item (self->storage, item);
 }
 
+static void
+on_item_selected (ClipmanHistory *history, ClipmanItem *item,
+                  gpointer user_data)
+{
+  select_item (CLIPMAN_APP (user_data), item);
+}
+
+static void
+on_service_item_selected (ClipmanService *service, ClipmanItem *item,
+                          gpointer user_data)
+{
+  select_item (CLIPMAN_APP (user_data), item);
+}
+
 static void
 on_item_deleted (ClipmanHistory *history, gint64 id, gpointer user_data)
 {
   ClipmanApp *self = CLIPMAN_APP (user_data);
 
+  if (!self->storage)
+    return;
+
   clipman_storage_remove_item (self->storage, id);
   clipman_history_refresh (self->history);
 }
@@ -123,6 +309,9 @@ on_clear_requested (ClipmanHistory *history, gpointer user_data)
 {
   ClipmanApp *self = CLIPMAN_APP (user_data);
 
+  if (!self->storage)
+    return;
+
   if (g_settings_get_boolean (self->settings, "confirm-clear"))
     {
       GtkWidget *dialog = gtk_message_dialog_new (
@@ -141,7 +330,31 @@ on_clear_requested (ClipmanHistory *history, gpointer user_data)
     }
 
   clipman_storage_clear (self->storage);
-  clipman_history_refresh (self->history);
+  if (self->history)
+    clipman_history_refresh (self->history);
+}
+
+static void
+show_history (ClipmanApp *self)
+{
+  /* The window is only built the first time it is needed.  If the
+   * storage is still being opened it draws from the recent items snapshot
+   * and catches up once the storage is set. */
+  if (!self->history)
+    {
+      self->history = clipman_history_new (self->storage, self->settings);
+
+      g_signal_connect (self->history, "item-selected",
+                        G_CALLBACK (on_item_selected), self);
+      g_signal_connect (self->history, "item-deleted",
+                        G_CALLBACK (on_item_deleted), self);
+      g_signal_connect (self->history, "clear-requested",
+                        G_CALLBACK (on_clear_requested), self);
+      g_signal_connect (self->history, "hide",
+                        G_CALLBACK (on_history_hidden), self);
+    }
+
+  clipman_history_show_popup (self->history);
 }
 
 static void
@@ -150,7 +363,7 @@ show_history_action (GSimpleAction *action, GVariant *parameter,
 {
   ClipmanApp *self = CLIPMAN_APP (user_data);
 
-  clipman_history_show_popup (self->history);
+  show_history (self);
 }
 
 static void
@@ -182,12 +395,33 @@ quit_action (GSimpleAction *action, GVariant *parameter, gpointer user_data)
   g_application_quit (G_APPLICATION (self));
 }
 
+static gboolean
+on_sigterm (gpointer user_data)
+{
+  /* The session ends by signal; shut down cleanly so the storage can
+   * finish its writes */
+  g_application_quit (G_APPLICATION (user_data));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+on_sigusr1 (gpointer user_data)
+{
+  gchar *latencies = clipman_latency_to_string ();
+
+  g_printerr ("%s", latencies);
+  g_free (latencies);
+
+  return G_SOURCE_CONTINUE;
+}
+
 static void
 on_status_icon_activate (GtkStatusIcon *icon, gpointer user_data)
 {
   ClipmanApp *self = CLIPMAN_APP (user_data);
 
-  clipman_history_show_popup (self->history);
+  show_history (self);
 }
 
 static void
@@ -203,7 +437,7 @@ static void
 on_menu_show_history (GtkMenuItem *item, gpointer user_data)
 {
   ClipmanApp *self = CLIPMAN_APP (user_data);
-  clipman_history_show_popup (self->history);
+  show_history (self);
 }
 
 static void
@@ -293,6 +527,157 @@ create_status_icon (ClipmanApp *self)
                     G_CALLBACK (on_status_icon_popup), self);
 }
 
+static void
+add_manager (ClipmanApp *self, GdkDisplay *display, ClipmanStorage *storage)
+{
+  ClipmanManager *manager = clipman_manager_new_for_display (display);
+
+  clipman_manager_set_settings (manager, self->settings);
+  if (self->trace)
+    clipman_manager_set_trace (manager, self->trace);
+
+  g_signal_connect (manager, "item-received",
+                    G_CALLBACK (on_item_received), self);
+  g_signal_connect (manager, "clipboard-empty",
+                    G_CALLBACK (on_clipboard_empty), self);
+
+  clipman_manager_start (manager);
+
+  g_ptr_array_add (self->managers, manager);
+  g_ptr_array_add (self->storages, storage);
+}
+
+/* Other X sessions may belong to other people, so an added display gets a
+ * history of its own, named after the display */
+static ClipmanStorage *
+open_display_storage (ClipmanApp *self, GdkDisplay *display)
+{
+  ClipmanStorage *storage;
+  gchar *name;
+  gchar *dir;
+  gchar *path;
+
+  name = g_strcanon (g_strdup (gdk_display_get_name (display)),
+                     G_CSET_A_2_Z G_CSET_a_2_z G_CSET_DIGITS "._-", '_');
+
+  if (self->ephemeral)
+    {
+      dir = self->ephemeral_sync_dir
+                ? g_build_filename (self->ephemeral_sync_dir, "displays",
+                                    name, NULL)
+                : NULL;
+      storage = clipman_storage_new_for_path (":memory:", dir);
+      g_free (dir);
+      g_free (name);
+      return storage;
+    }
+
+  dir = g_build_filename (g_get_user_data_dir (), "mate-clipman", "displays",
+                          name, NULL);
+  g_mkdir_with_parents (dir, 0700);
+
+  path = g_build_filename (dir, "history.db", NULL);
+  storage = clipman_storage_new_for_path (path, NULL);
+
+  g_free (path);
+  g_free (dir);
+  g_free (name);
+
+  return storage;
+}
+
+static void
+set_storage (ClipmanApp *self, ClipmanStorage *storage)
+{
+  GDBusConnection *connection;
+  GError *error = NULL;
+  guint i;
+
+  self->storage = storage;
+  self->managers = g_ptr_array_new_with_free_func (g_object_unref);
+  self->storages = g_ptr_array_new_with_free_func (g_object_unref);
+  self->displays
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)gdk_display_close);
+
+  if (self->trace_path)
+    {
+      GFile *file = g_file_new_for_commandline_arg (self->trace_path);
+
+      self->trace = G_OUTPUT_STREAM (
+          g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, &error));
+      if (!self->trace)
+        {
+          g_warning ("Failed to open clipboard trace: %s", error->message);
+          g_clear_error (&error);
+        }
+      g_object_unref (file);
+    }
+
+  /* Monitor the default display and every display added on the command
+   * line.  Each has a history of its own, while the user interface and
+   * D-Bus service stay on the default display. */
+  add_manager (self, gdk_display_get_default (), g_object_ref (storage));
+
+  for (i = 0; self->extra_displays && self->extra_displays[i]; i++)
+    {
+      GdkDisplay *display = gdk_display_open (self->extra_displays[i]);
+
+      if (display)
+        {
+          g_ptr_array_add (self->displays, display);
+          add_manager (self, display, open_display_storage (self, display));
+        }
+      else
+        {
+          g_warning ("Cannot open display %s", self->extra_displays[i]);
+        }
+    }
+
+  g_signal_connect (self->settings, "changed::backup-interval",
+                    G_CALLBACK (on_backup_settings_changed), self);
+  g_signal_connect (self->settings, "changed::backup-count",
+                    G_CALLBACK (on_backup_settings_changed), self);
+  on_backup_settings_changed (self->settings, NULL, self);
+
+  /* Serve the history to the panel applet and other clients, so only
+   * this process monitors the clipboard and writes to the database */
+  connection = g_application_get_dbus_connection (G_APPLICATION (self));
+  if (connection)
+    {
+      self->service = clipman_service_new (self->storage);
+      g_signal_connect (self->service, "item-selected",
+                        G_CALLBACK (on_service_item_selected), self);
+
+      if (!clipman_service_export (self->service, connection, &error))
+        {
+          g_warning ("Failed to export history service: %s", error->message);
+          g_clear_error (&error);
+        }
+    }
+
+  if (self->history)
+    clipman_history_set_storage (self->history, self->storage);
+}
+
+static void
+on_storage_ready (GObject *source_object, GAsyncResult *result,
+                  gpointer user_data)
+{
+  ClipmanStorage *storage;
+  GError *error = NULL;
+
+  storage = clipman_storage_new_finish (result, &error);
+  if (!storage)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Failed to open clipboard history: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  set_storage (CLIPMAN_APP (user_data), storage);
+}
+
 static void
 clipman_app_startup (GApplication *app)
 {
@@ -313,33 +698,30 @@ clipman_app_startup (GApplication *app)
   /* Initialize settings */
   self->settings = g_settings_new ("org.mate.clipman");
 
-  /* Initialize storage */
-  self->storage = clipman_storage_new ();
-
-  /* Initialize clipboard manager */
-  self->manager = clipman_manager_new ();
-  clipman_manager_set_settings (self->manager, self->settings);
-
-  g_signal_connect (self->manager, "item-received",
-                    G_CALLBACK (on_item_received), self);
-  g_signal_connect (self->manager, "clipboard-empty",
-                    G_CALLBACK (on_clipboard_empty), self);
-
-  /* Initialize history window */
-  self->history = clipman_history_new (self->storage, self->settings);
-
-  g_signal_connect (self->history, "item-selected",
-                    G_CALLBACK (on_item_selected), self);
-  g_signal_connect (self->history, "item-deleted",
-                    G_CALLBACK (on_item_deleted), self);
-  g_signal_connect (self->history, "clear-requested",
-                    G_CALLBACK (on_clear_requested), self);
-
-  /* Create status icon */
-  create_status_icon (self);
-
-  /* Start monitoring */
-  clipman_manager_start (self->manager);
+  /* Create status icon, unless the panel applet provides the UI */
+  if (!self->daemon)
+    create_status_icon (self);
+
+  self->sigterm_id = g_unix_signal_add (SIGTERM, on_sigterm, self);
+  self->sigusr1_id = g_unix_signal_add (SIGUSR1, on_sigusr1, self);
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+  /* Many instances may share a terminal server, so give memory back when
+   * the system runs low */
+  self->memory_monitor = g_memory_monitor_dup_default ();
+  g_signal_connect (self->memory_monitor, "low-memory-warning",
+                    G_CALLBACK (on_low_memory_warning), self);
+#endif
+
+  /* Everything else needs the storage, which is opened in a thread so the
+   * main loop starts right away.  An in-memory history has nothing to
+   * load and is opened directly. */
+  self->cancellable = g_cancellable_new ();
+  if (self->ephemeral)
+    set_storage (self, clipman_storage_new_for_path (
+                           ":memory:", self->ephemeral_sync_dir));
+  else
+    clipman_storage_new_async (self->cancellable, on_storage_ready, self);
 
   /* Hold the application to prevent it from quitting */
   g_application_hold (app);
@@ -352,7 +734,7 @@ clipman_app_activate (GApplication *app)
 
   if (!self->start_hidden)
     {
-      clipman_history_show_popup (self->history);
+      show_history (self);
     }
   else
     {
@@ -361,16 +743,114 @@ clipman_app_activate (GApplication *app)
     }
 }
 
+static gint
+export_history (const gchar *path)
+{
+  ClipmanStorage *storage;
+  GFile *file;
+  GFileOutputStream *stream;
+  GError *error = NULL;
+  gboolean ok = FALSE;
+
+  file = g_file_new_for_commandline_arg (path);
+  stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL,
+                           &error);
+  if (stream)
+    {
+      storage = clipman_storage_new ();
+      ok = clipman_storage_export (storage, G_OUTPUT_STREAM (stream), NULL,
+                                   &error)
+           && g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+      g_object_unref (storage);
+      g_object_unref (stream);
+    }
+  g_object_unref (file);
+
+  if (!ok)
+    {
+      g_printerr (_ ("Failed to export history: %s\n"), error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  return 0;
+}
+
+static gint
+import_history (const gchar *path)
+{
+  ClipmanStorage *storage;
+  GFile *file;
+  GFileInputStream *stream;
+  GError *error = NULL;
+  guint n_imported = 0;
+  gboolean ok = FALSE;
+
+  file = g_file_new_for_commandline_arg (path);
+  stream = g_file_read (file, NULL, &error);
+  if (stream)
+    {
+      storage = clipman_storage_new ();
+      ok = clipman_storage_import (storage, G_INPUT_STREAM (stream),
+                                   &n_imported, NULL, &error);
+      g_object_unref (storage);
+      g_object_unref (stream);
+    }
+  g_object_unref (file);
+
+  if (!ok)
+    {
+      g_printerr (_ ("Failed to import history: %s\n"), error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_print (_ ("Imported %u items\n"), n_imported);
+
+  return 0;
+}
+
 static gint
 clipman_app_handle_local_options (GApplication *app, GVariantDict *options)
 {
   ClipmanApp *self = CLIPMAN_APP (app);
+  const gchar *path;
+
+  /* Export and import run in this process and exit without starting the
+   * user interface */
+  if (g_variant_dict_lookup (options, "export", "^&ay", &path))
+    return export_history (path);
+
+  if (g_variant_dict_lookup (options, "import", "^&ay", &path))
+    return import_history (path);
+
+  if (g_variant_dict_contains (options, "daemon"))
+    {
+      self->daemon = TRUE;
+      self->start_hidden = TRUE;
+    }
 
   if (g_variant_dict_contains (options, "hidden"))
     {
       self->start_hidden = TRUE;
     }
 
+  if (g_variant_dict_contains (options, "ephemeral"))
+    {
+      self->ephemeral = TRUE;
+    }
+
+  /* An in-memory history that is still copied to disk now and then */
+  if (g_variant_dict_lookup (options, "ephemeral-sync", "^ay",
+                             &self->ephemeral_sync_dir))
+    {
+      self->ephemeral = TRUE;
+    }
+
+  g_variant_dict_lookup (options, "add-display", "^as",
+                         &self->extra_displays);
+  g_variant_dict_lookup (options, "record-trace", "^ay", &self->trace_path);
+
   return -1; /* Continue processing */
 }
 
@@ -379,13 +859,44 @@ clipman_app_shutdown (GApplication *app)
 {
   ClipmanApp *self = CLIPMAN_APP (app);
 
-  clipman_manager_stop (self->manager);
+  /* A storage still being opened is dropped when it is ready */
+  if (self->cancellable)
+    g_cancellable_cancel (self->cancellable);
 
-  /* Disconnect signal handlers before destroying objects */
-  if (self->manager)
+  for (guint i = 0; self->managers && i < self->managers->len; i++)
+    {
+      ClipmanManager *manager = g_ptr_array_index (self->managers, i);
+
+      clipman_manager_stop (manager);
+      g_signal_handlers_disconnect_by_data (manager, self);
+    }
+
+  if (self->trim_id > 0)
     {
-      g_signal_handlers_disconnect_by_data (self->manager, self);
+      g_source_remove (self->trim_id);
+      self->trim_id = 0;
     }
+
+  if (self->sigterm_id > 0)
+    {
+      g_source_remove (self->sigterm_id);
+      self->sigterm_id = 0;
+    }
+  if (self->sigusr1_id > 0)
+    {
+      g_source_remove (self->sigusr1_id);
+      self->sigusr1_id = 0;
+    }
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+  if (self->memory_monitor)
+    {
+      g_signal_handlers_disconnect_by_data (self->memory_monitor, self);
+      g_clear_object (&self->memory_monitor);
+    }
+#endif
+
+  /* Disconnect signal handlers before destroying objects */
   if (self->history)
     {
       g_signal_handlers_disconnect_by_data (self->history, self);
@@ -394,8 +905,25 @@ clipman_app_shutdown (GApplication *app)
     {
       g_signal_handlers_disconnect_by_data (self->status_icon, self);
     }
+  if (self->settings)
+    {
+      g_signal_handlers_disconnect_by_data (self->settings, self);
+    }
+  if (self->service)
+    {
+      g_signal_handlers_disconnect_by_data (self->service, self);
+      clipman_service_unexport (self->service);
+    }
 
-  g_clear_object (&self->manager);
+  g_clear_object (&self->service);
+  g_clear_object (&self->cancellable);
+  g_clear_pointer (&self->managers, g_ptr_array_unref);
+  g_clear_pointer (&self->storages, g_ptr_array_unref);
+  g_clear_pointer (&self->displays, g_ptr_array_unref);
+  g_clear_pointer (&self->ephemeral_sync_dir, g_free);
+  g_clear_pointer (&self->extra_displays, g_strfreev);
+  g_clear_pointer (&self->trace_path, g_free);
+  g_clear_object (&self->trace);
   g_clear_object (&self->storage);
   g_clear_object (&self->settings);
   g_clear_object (&self->status_icon);
@@ -427,6 +955,37 @@ clipman_app_init (ClipmanApp *self)
   g_application_add_main_option (G_APPLICATION (self), "hidden", 'h',
                                  G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
                                  _ ("Start hidden in system tray"), NULL);
+  g_application_add_main_option (
+      G_APPLICATION (self), "daemon", 'd', G_OPTION_FLAG_NONE,
+      G_OPTION_ARG_NONE,
+      _ ("Run without a tray icon, serving the panel applet"), NULL);
+  g_application_add_main_option (
+      G_APPLICATION (self), "ephemeral", 0, G_OPTION_FLAG_NONE,
+      G_OPTION_ARG_NONE,
+      _ ("Keep the history in memory only, forgetting it on exit"), NULL);
+  g_application_add_main_option (
+      G_APPLICATION (self), "ephemeral-sync", 0, G_OPTION_FLAG_NONE,
+      G_OPTION_ARG_FILENAME,
+      _ ("Keep the history in memory, copying it to DIR after changes"),
+      _ ("DIR"));
+  g_application_add_main_option (
+      G_APPLICATION (self), "add-display", 0, G_OPTION_FLAG_NONE,
+      G_OPTION_ARG_STRING_ARRAY,
+      _ ("Also monitor the clipboard of DISPLAY; may be repeated"),
+      _ ("DISPLAY"));
+  g_application_add_main_option (
+      G_APPLICATION (self), "record-trace", 0, G_OPTION_FLAG_NONE,
+      G_OPTION_ARG_FILENAME,
+      _ ("Append the time, type and size of every copy to FILE"),
+      _ ("FILE"));
+  g_application_add_main_option (
+      G_APPLICATION (self), "export", 0, G_OPTION_FLAG_NONE,
+      G_OPTION_ARG_FILENAME, _ ("Export clipboard history to FILE"),
+      _ ("FILE"));
+  g_application_add_main_option (
+      G_APPLICATION (self), "import", 0, G_OPTION_FLAG_NONE,
+      G_OPTION_ARG_FILENAME, _ ("Import clipboard history from FILE"),
+      _ ("FILE"));
 }
 
 ClipmanApp *
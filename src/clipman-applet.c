@@ -31,138 +31,47 @@
 #include "clipman.h"
 #include <mate-panel-applet.h>
 
+/* The applet only draws a button; clipboard monitoring, storage and the
+ * history popup live in the mate-clipman process, which is started on
+ * demand through D-Bus activation */
 typedef struct
 {
   MatePanelApplet *applet;
-  GSettings *settings;
-  ClipmanStorage *storage;
-  ClipmanManager *manager;
-  ClipmanHistory *history;
-  ClipmanPreferences *preferences;
+  GDBusActionGroup *actions;
 
   GtkWidget *button;
   GtkWidget *image;
 } ClipmanAppletData;
 
 static void
-on_item_received (ClipmanManager *manager, ClipmanItem *item,
-                  gpointer user_data)
+activate_action (ClipmanAppletData *data, const gchar *name)
 {
-  ClipmanAppletData *data = user_data;
-
-  clipman_storage_add_item (data->storage, item);
-
-  /* Sync selections if enabled */
-  if (g_settings_get_boolean (data->settings, "sync-selections"))
-    {
-      GtkClipboard *clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
-      GtkClipboard *primary = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
-      ClipmanSource source = clipman_item_get_source (item);
-
-      if (source == CLIPMAN_SOURCE_CLIPBOARD)
-        {
-          clipman_item_to_clipboard (item, primary);
-        }
-      else
-        {
-          clipman_item_to_clipboard (item, clipboard);
-        }
-    }
-}
-
-static void
-on_clipboard_empty (ClipmanManager *manager, gint source, gpointer user_data)
-{
-  ClipmanAppletData *data = user_data;
-
-  if (!g_settings_get_boolean (data->settings, "keep-content"))
-    return;
-
-  GList *items = clipman_storage_get_items (data->storage, 1);
-  if (items)
+  if (!data->actions)
     {
-      ClipmanItem *item = items->data;
-      GtkClipboard *clipboard;
-
-      if (source == CLIPMAN_SOURCE_PRIMARY)
-        clipboard = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
-      else
-        clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
-
-      clipman_item_to_clipboard (item, clipboard);
-      g_list_free_full (items, g_object_unref);
+      g_warning ("Clipboard manager service is not available");
+      return;
     }
-}
-
-static void
-on_item_selected (ClipmanHistory *history, ClipmanItem *item,
-                  gpointer user_data)
-{
-  ClipmanAppletData *data = user_data;
-  GtkClipboard *clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
-
-  clipman_item_to_clipboard (item, clipboard);
-  clipman_storage_add_item (data->storage, item);
-}
 
-static void
-on_item_deleted (ClipmanHistory *history, gint64 id, gpointer user_data)
-{
-  ClipmanAppletData *data = user_data;
-
-  clipman_storage_remove_item (data->storage, id);
-  clipman_history_refresh (data->history);
-}
-
-static void
-on_clear_requested (ClipmanHistory *history, gpointer user_data)
-{
-  ClipmanAppletData *data = user_data;
-
-  if (g_settings_get_boolean (data->settings, "confirm-clear"))
-    {
-      GtkWidget *dialog = gtk_message_dialog_new (
-          NULL, GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO,
-          _ ("Clear all clipboard history?"));
-      gtk_message_dialog_format_secondary_text (
-          GTK_MESSAGE_DIALOG (dialog), _ ("This action cannot be undone."));
-
-      gint response = gtk_dialog_run (GTK_DIALOG (dialog));
-      gtk_widget_destroy (dialog);
-
-      if (response != GTK_RESPONSE_YES)
-        return;
-    }
-
-  clipman_storage_clear (data->storage);
-  clipman_history_refresh (data->history);
+  g_action_group_activate_action (G_ACTION_GROUP (data->actions), name,
+                                  NULL);
 }
 
 static void
 on_button_clicked (GtkButton *button, gpointer user_data)
 {
-  ClipmanAppletData *data = user_data;
-
-  clipman_history_show_popup (data->history);
+  activate_action (user_data, "show-history");
 }
 
 static void
 show_preferences (GtkAction *action, gpointer user_data)
 {
-  ClipmanAppletData *data = user_data;
-
-  if (!data->preferences)
-    data->preferences = clipman_preferences_new (NULL, data->settings);
-
-  gtk_window_present (GTK_WINDOW (data->preferences));
+  activate_action (user_data, "preferences");
 }
 
 static void
 clear_history (GtkAction *action, gpointer user_data)
 {
-  ClipmanAppletData *data = user_data;
-
-  on_clear_requested (data->history, data);
+  activate_action (user_data, "clear");
 }
 
 static void
@@ -196,19 +105,7 @@ static const gchar *applet_menu_xml
 static void
 applet_data_free (ClipmanAppletData *data)
 {
-  if (data->manager)
-    {
-      clipman_manager_stop (data->manager);
-      g_object_unref (data->manager);
-    }
-
-  g_clear_object (&data->storage);
-  g_clear_object (&data->settings);
-
-  if (data->history)
-    gtk_widget_destroy (GTK_WIDGET (data->history));
-  if (data->preferences)
-    gtk_widget_destroy (GTK_WIDGET (data->preferences));
+  g_clear_object (&data->actions);
 
   g_free (data);
 }
@@ -225,6 +122,8 @@ clipman_applet_fill (MatePanelApplet *applet)
 {
   ClipmanAppletData *data;
   GtkActionGroup *action_group;
+  GDBusConnection *connection;
+  GError *error = NULL;
 
   /* Set up applet */
   mate_panel_applet_set_flags (applet, MATE_PANEL_APPLET_EXPAND_MINOR
@@ -247,25 +146,19 @@ clipman_applet_fill (MatePanelApplet *applet)
   gtk_container_add (GTK_CONTAINER (applet), data->button);
   gtk_widget_show_all (GTK_WIDGET (applet));
 
-  /* Initialize components */
-  data->settings = g_settings_new ("org.mate.clipman");
-  data->storage = clipman_storage_new ();
-  data->manager = clipman_manager_new ();
-  clipman_manager_set_settings (data->manager, data->settings);
-
-  g_signal_connect (data->manager, "item-received",
-                    G_CALLBACK (on_item_received), data);
-  g_signal_connect (data->manager, "clipboard-empty",
-                    G_CALLBACK (on_clipboard_empty), data);
-
-  data->history = clipman_history_new (data->storage, data->settings);
-
-  g_signal_connect (data->history, "item-selected",
-                    G_CALLBACK (on_item_selected), data);
-  g_signal_connect (data->history, "item-deleted",
-                    G_CALLBACK (on_item_deleted), data);
-  g_signal_connect (data->history, "clear-requested",
-                    G_CALLBACK (on_clear_requested), data);
+  /* Talk to the clipboard manager */
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (connection)
+    {
+      data->actions = g_dbus_action_group_get (
+          connection, CLIPMAN_SERVICE_NAME, CLIPMAN_SERVICE_PATH);
+      g_object_unref (connection);
+    }
+  else
+    {
+      g_warning ("Cannot connect to the session bus: %s", error->message);
+      g_error_free (error);
+    }
 
   g_signal_connect (data->button, "clicked", G_CALLBACK (on_button_clicked),
                     data);
@@ -280,9 +173,6 @@ clipman_applet_fill (MatePanelApplet *applet)
 
   g_object_unref (action_group);
 
-  /* Start monitoring */
-  clipman_manager_start (data->manager);
-
   /* Clean up on destroy */
   g_signal_connect (applet, "destroy", G_CALLBACK (on_applet_destroy), data);
 
@@ -0,0 +1,261 @@
+/*
+ * clipman-cli.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ * 
+ * Copyright 2025 Kerem Soke
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+/* Command-line access to the history. This deliberately avoids clipman.h
+ * and GTK: it opens the database read-only and streams rows to stdout, so
+ * it starts fast enough to feed fzf or dmenu on every keypress. */
+
+#include "config.h"
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <locale.h>
+#include <sqlite3.h>
+#include <stdio.h>
+
+static gboolean opt_list;
+static gchar *opt_search;
+static gint64 opt_get = -1;
+static gint opt_limit;
+static gboolean opt_print0;
+
+static const GOptionEntry entries[] = {
+  { "list", 'l', 0, G_OPTION_ARG_NONE, &opt_list,
+    N_ ("List history items, newest first"), NULL },
+  { "search", 's', 0, G_OPTION_ARG_STRING, &opt_search,
+    N_ ("List items containing TEXT"), N_ ("TEXT") },
+  { "get", 'g', 0, G_OPTION_ARG_INT64, &opt_get,
+    N_ ("Write the content of item ID to standard output"), N_ ("ID") },
+  { "limit", 'n', 0, G_OPTION_ARG_INT, &opt_limit,
+    N_ ("Print at most N items"), N_ ("N") },
+  { "print0", '0', 0, G_OPTION_ARG_NONE, &opt_print0,
+    N_ ("Separate items with NUL instead of newline"), NULL },
+  { NULL }
+};
+
+static sqlite3 *
+open_history (GError **error)
+{
+  gchar *data_dir;
+  gchar *path;
+  gchar *archive_path;
+  gchar *sql;
+  sqlite3 *db = NULL;
+
+  /* With a network home the live history is a local copy in the runtime
+   * directory, and the one in the data directory may lag behind */
+  data_dir = g_build_filename (g_get_user_runtime_dir (), "mate-clipman",
+                               NULL);
+  path = g_build_filename (data_dir, "history.db", NULL);
+  if (!g_file_test (path, G_FILE_TEST_EXISTS))
+    {
+      g_free (data_dir);
+      g_free (path);
+      data_dir = g_build_filename (g_get_user_data_dir (), "mate-clipman",
+                                   NULL);
+      path = g_build_filename (data_dir, "history.db", NULL);
+    }
+  archive_path = g_build_filename (data_dir, "archive.db", NULL);
+  g_free (data_dir);
+
+  if (sqlite3_open_v2 (path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   _ ("Cannot open %s: %s"), path, sqlite3_errmsg (db));
+      sqlite3_close (db);
+      db = NULL;
+    }
+  else if (g_file_test (archive_path, G_FILE_TEST_EXISTS))
+    {
+      /* A read-only connection attaches read-only too */
+      sql = sqlite3_mprintf ("ATTACH DATABASE %Q AS archive", archive_path);
+      sqlite3_exec (db, sql, NULL, NULL, NULL);
+      sqlite3_free (sql);
+    }
+
+  g_free (path);
+  g_free (archive_path);
+
+  return db;
+}
+
+static void
+print_row (sqlite3_stmt *stmt)
+{
+  const gchar *label = (const gchar *)sqlite3_column_text (stmt, 1);
+
+  printf ("%" G_GINT64_FORMAT "\t", (gint64) sqlite3_column_int64 (stmt, 0));
+
+  /* Keep one item per line unless the separator is NUL */
+  for (const gchar *p = label ? label : ""; *p; p++)
+    putchar (!opt_print0 && (*p == '\n' || *p == '\t') ? ' ' : *p);
+
+  putchar (opt_print0 ? '\0' : '\n');
+}
+
+static gint
+list_items (sqlite3 *db, const gchar *schema, const gchar *query, gint limit)
+{
+  sqlite3_stmt *stmt;
+  gchar *sql;
+  gint n = 0;
+
+  /* Each tier is walked in timestamp index order instead of sorting the
+   * union, so the first rows are printed without reading the whole
+   * history. The archive only holds items older than the hot tier. */
+  sql = g_strdup_printf ("SELECT id, label FROM %s.items "
+                         "WHERE ?1 IS NULL OR text_content LIKE ?1 "
+                         "OR label LIKE ?1 "
+                         "ORDER BY timestamp DESC LIMIT ?2",
+                         schema);
+
+  if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL) == SQLITE_OK)
+    {
+      if (query)
+        sqlite3_bind_text (stmt, 1, g_strdup_printf ("%%%s%%", query), -1,
+                           g_free);
+      sqlite3_bind_int (stmt, 2, limit);
+
+      while (sqlite3_step (stmt) == SQLITE_ROW)
+        {
+          print_row (stmt);
+          n++;
+        }
+
+      sqlite3_finalize (stmt);
+    }
+
+  g_free (sql);
+
+  return n;
+}
+
+static void
+list_history (sqlite3 *db)
+{
+  gboolean unlimited = opt_limit <= 0;
+  gint n;
+
+  n = list_items (db, "main", opt_search, unlimited ? -1 : opt_limit);
+
+  /* No archive is attached until old items were moved to one */
+  if (!sqlite3_db_filename (db, "archive"))
+    return;
+
+  if (unlimited)
+    list_items (db, "archive", opt_search, -1);
+  else if (n < opt_limit)
+    list_items (db, "archive", opt_search, opt_limit - n);
+}
+
+static gboolean
+get_item (sqlite3 *db, gint64 id)
+{
+  sqlite3_stmt *stmt;
+  const gchar *sql
+      = "SELECT coalesce(CAST(text_content AS BLOB), image_data) "
+        "FROM main.items WHERE id = ?1";
+  gboolean found = FALSE;
+
+  for (guint i = 0; i < 2 && !found; i++)
+    {
+      if (i == 1)
+        sql = "SELECT coalesce(CAST(text_content AS BLOB), image_data) "
+              "FROM archive.items WHERE id = ?1";
+
+      if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        break;
+
+      sqlite3_bind_int64 (stmt, 1, id);
+      if (sqlite3_step (stmt) == SQLITE_ROW)
+        {
+          fwrite (sqlite3_column_blob (stmt, 0), 1,
+                  sqlite3_column_bytes (stmt, 0), stdout);
+          found = TRUE;
+        }
+
+      sqlite3_finalize (stmt);
+    }
+
+  return found;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  sqlite3 *db;
+  gint status = 0;
+
+  setlocale (LC_ALL, "");
+  bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
+  bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+  textdomain (GETTEXT_PACKAGE);
+
+  context = g_option_context_new (NULL);
+  g_option_context_set_summary (context,
+                                _ ("Print the MATE clipboard history"));
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  db = open_history (&error);
+  if (!db)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  if (opt_get >= 0)
+    {
+      if (!get_item (db, opt_get))
+        {
+          g_printerr ("%s: %" G_GINT64_FORMAT "\n",
+                      _ ("No such history item"), opt_get);
+          status = 1;
+        }
+    }
+  else
+    {
+      /* --list is the default action */
+      list_history (db);
+    }
+
+  sqlite3_close (db);
+  g_free (opt_search);
+
+  if (fflush (stdout) != 0)
+    status = 1;
+
+  return status;
+}
@@ -0,0 +1,245 @@
+/*
+ * clipman-daemon.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ * 
+ * Copyright 2025 Kerem Soke
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+/* Headless clipboard daemon.  Selections are monitored and served through
+ * Xlib and XFixes instead of GTK, items go through the same storage, and
+ * the history service is exported on the session bus so mate-clipman-cli
+ * and other D-Bus clients work against it.  It replaces mate-clipman
+ * --daemon where no popup is needed; both own the same bus name. */
+
+#include "clipman.h"
+#include "config.h"
+#include <glib-unix.h>
+#include <locale.h>
+#include <signal.h>
+
+typedef struct
+{
+  GMainLoop *loop;
+  GSettings *settings;
+  ClipmanStorage *storage;
+  ClipmanSelection *selection;
+  ClipmanService *service;
+} Daemon;
+
+static gchar *opt_display;
+
+static const GOptionEntry entries[] = {
+  { "display", 0, 0, G_OPTION_ARG_STRING, &opt_display,
+    N_ ("X display to use"), N_ ("DISPLAY") },
+  { NULL }
+};
+
+static void
+on_backup_settings_changed (GSettings *settings, const gchar *key,
+                            gpointer user_data)
+{
+  Daemon *daemon = user_data;
+  gint interval = g_settings_get_int (settings, "backup-interval");
+  gint count = g_settings_get_int (settings, "backup-count");
+
+  clipman_storage_set_backup_policy (daemon->storage, MAX (interval, 0) * 60,
+                                     MAX (count, 0));
+}
+
+static void
+on_item_received (ClipmanSelection *selection, ClipmanItem *item,
+                  gpointer user_data)
+{
+  Daemon *daemon = user_data;
+
+  clipman_storage_add_item (daemon->storage, item);
+
+  /* Sync selections if enabled */
+  if (g_settings_get_boolean (daemon->settings, "sync-selections"))
+    {
+      if (clipman_item_get_source (item) == CLIPMAN_SOURCE_CLIPBOARD)
+        clipman_selection_set_item (selection, item, CLIPMAN_SOURCE_PRIMARY);
+      else
+        clipman_selection_set_item (selection, item,
+                                    CLIPMAN_SOURCE_CLIPBOARD);
+    }
+}
+
+static void
+on_clipboard_empty (ClipmanSelection *selection, gint source,
+                    gpointer user_data)
+{
+  Daemon *daemon = user_data;
+  GList *items;
+
+  if (!g_settings_get_boolean (daemon->settings, "keep-content"))
+    return;
+
+  /* Restore last item to clipboard */
+  items = clipman_storage_get_items (daemon->storage, 1);
+  if (items)
+    {
+      clipman_selection_set_item (selection, items->data, source);
+      g_list_free_full (items, g_object_unref);
+    }
+}
+
+static void
+on_service_item_selected (ClipmanService *service, ClipmanItem *item,
+                          gpointer user_data)
+{
+  Daemon *daemon = user_data;
+
+  clipman_selection_set_item (daemon->selection, item,
+                              CLIPMAN_SOURCE_CLIPBOARD);
+
+  /* Update timestamp in storage */
+  clipman_storage_add_item (daemon->storage, item);
+}
+
+static void
+on_bus_acquired (GDBusConnection *connection, const gchar *name,
+                 gpointer user_data)
+{
+  Daemon *daemon = user_data;
+  GError *error = NULL;
+
+  if (!clipman_service_export (daemon->service, connection, &error))
+    {
+      g_warning ("Failed to export history service: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+on_name_lost (GDBusConnection *connection, const gchar *name,
+              gpointer user_data)
+{
+  Daemon *daemon = user_data;
+
+  /* Another clipboard manager is running for this session */
+  g_printerr (_ ("Cannot own %s, is mate-clipman already running?\n"), name);
+  g_main_loop_quit (daemon->loop);
+}
+
+static gboolean
+on_quit_signal (gpointer user_data)
+{
+  Daemon *daemon = user_data;
+
+  g_main_loop_quit (daemon->loop);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+on_dump_signal (gpointer user_data)
+{
+  gchar *latencies = clipman_latency_to_string ();
+
+  g_printerr ("%s", latencies);
+  g_free (latencies);
+
+  return G_SOURCE_CONTINUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  Daemon daemon = { 0 };
+  guint owner_id;
+
+  setlocale (LC_ALL, "");
+  bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
+  bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+  textdomain (GETTEXT_PACKAGE);
+
+  context = g_option_context_new (NULL);
+  g_option_context_set_summary (
+      context, _ ("Record the clipboard history without a user interface"));
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  daemon.selection = clipman_selection_new (opt_display, &error);
+  if (!daemon.selection)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  daemon.loop = g_main_loop_new (NULL, FALSE);
+  daemon.settings = g_settings_new ("org.mate.clipman");
+  daemon.storage = clipman_storage_new ();
+  daemon.service = clipman_service_new (daemon.storage);
+
+  g_signal_connect (daemon.settings, "changed::backup-interval",
+                    G_CALLBACK (on_backup_settings_changed), &daemon);
+  g_signal_connect (daemon.settings, "changed::backup-count",
+                    G_CALLBACK (on_backup_settings_changed), &daemon);
+  on_backup_settings_changed (daemon.settings, NULL, &daemon);
+
+  g_signal_connect (daemon.service, "item-selected",
+                    G_CALLBACK (on_service_item_selected), &daemon);
+  owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, CLIPMAN_SERVICE_NAME,
+                             G_BUS_NAME_OWNER_FLAGS_NONE, on_bus_acquired,
+                             NULL, on_name_lost, &daemon, NULL);
+
+  clipman_selection_set_settings (daemon.selection, daemon.settings);
+  g_signal_connect (daemon.selection, "item-received",
+                    G_CALLBACK (on_item_received), &daemon);
+  g_signal_connect (daemon.selection, "clipboard-empty",
+                    G_CALLBACK (on_clipboard_empty), &daemon);
+  clipman_selection_start (daemon.selection);
+
+  g_unix_signal_add (SIGINT, on_quit_signal, &daemon);
+  g_unix_signal_add (SIGTERM, on_quit_signal, &daemon);
+  g_unix_signal_add (SIGUSR1, on_dump_signal, NULL);
+
+  g_main_loop_run (daemon.loop);
+
+  clipman_selection_stop (daemon.selection);
+  g_bus_unown_name (owner_id);
+  clipman_service_unexport (daemon.service);
+
+  g_signal_handlers_disconnect_by_data (daemon.selection, &daemon);
+  g_signal_handlers_disconnect_by_data (daemon.service, &daemon);
+  g_signal_handlers_disconnect_by_data (daemon.settings, &daemon);
+
+  g_object_unref (daemon.selection);
+  g_object_unref (daemon.service);
+  g_object_unref (daemon.storage);
+  g_object_unref (daemon.settings);
+  g_main_loop_unref (daemon.loop);
+  g_free (opt_display);
+
+  return 0;
+}
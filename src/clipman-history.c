@@ -43,6 +43,8 @@ struct _ClipmanHistory
   GtkWidget *scrolled;
   GtkWidget *empty_label;
   GtkWidget *stack;
+
+  guint reload_id;
 };
 
 G_DEFINE_TYPE (ClipmanHistory, clipman_history, GTK_TYPE_WINDOW)
@@ -62,6 +64,15 @@ clipman_history_dispose (GObject *object)
 {
   ClipmanHistory *self = CLIPMAN_HISTORY (object);
 
+  if (self->reload_id > 0)
+    {
+      g_source_remove (self->reload_id);
+      self->reload_id = 0;
+    }
+
+  if (self->storage)
+    g_signal_handlers_disconnect_by_data (self->storage, self);
+
   g_clear_object (&self->storage);
   g_clear_object (&self->settings);
 
@@ -89,25 +100,22 @@ clipman_history_class_init (ClipmanHistoryClass *klass)
 }
 
 static GtkWidget *
-create_item_row (ClipmanHistory *self, ClipmanItem *item)
+create_row (ClipmanHistory *self, gint64 id, ClipmanItemType type,
+            const gchar *text, GdkPixbuf *thumbnail)
 {
   GtkWidget *row;
   GtkWidget *box;
   GtkWidget *label;
   GtkWidget *delete_btn;
   GtkWidget *image = NULL;
-  ClipmanItemType type;
 
   row = gtk_list_box_row_new ();
-  g_object_set_data_full (G_OBJECT (row), "item", g_object_ref (item),
-                          g_object_unref);
+  g_object_set_data (G_OBJECT (row), "item-id", GINT_TO_POINTER ((gint)id));
 
   box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
   gtk_container_set_border_width (GTK_CONTAINER (box), 6);
   gtk_container_add (GTK_CONTAINER (row), box);
 
-  type = clipman_item_get_item_type (item);
-
   /* Icon based on type */
   const gchar *icon_name;
   switch (type)
@@ -128,51 +136,98 @@ create_item_row (ClipmanHistory *self, ClipmanItem *item)
   image = gtk_image_new_from_icon_name (icon_name, GTK_ICON_SIZE_MENU);
   gtk_box_pack_start (GTK_BOX (box), image, FALSE, FALSE, 0);
 
+  if (thumbnail)
+    gtk_image_set_from_pixbuf (GTK_IMAGE (image), thumbnail);
+
+  /* Label */
+  label = gtk_label_new (text);
+  gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+  gtk_label_set_ellipsize (GTK_LABEL (label), PANGO_ELLIPSIZE_END);
+  gtk_widget_set_hexpand (label, TRUE);
+  gtk_box_pack_start (GTK_BOX (box), label, TRUE, TRUE, 0);
+
+  /* Delete button */
+  delete_btn = gtk_button_new_from_icon_name ("edit-delete-symbolic",
+                                              GTK_ICON_SIZE_BUTTON);
+  gtk_button_set_relief (GTK_BUTTON (delete_btn), GTK_RELIEF_NONE);
+  gtk_widget_set_tooltip_text (delete_btn, _ ("Delete this item"));
+  g_object_set_data (G_OBJECT (delete_btn), "item-id",
+                     GINT_TO_POINTER ((gint)id));
+  gtk_box_pack_end (GTK_BOX (box), delete_btn, FALSE, FALSE, 0);
+
+  gtk_widget_show_all (row);
+
+  return row;
+}
+
+static gboolean
+show_previews (ClipmanHistory *self)
+{
+  return self->settings
+         && g_settings_get_boolean (self->settings, "show-preview");
+}
+
+static GtkWidget *
+create_item_row (ClipmanHistory *self, ClipmanItem *item)
+{
+  ClipmanItemType type = clipman_item_get_item_type (item);
+  GdkPixbuf *thumbnail = NULL;
+  GtkWidget *row;
+
   /* Show thumbnail for images if enabled */
-  if (type == CLIPMAN_ITEM_TYPE_IMAGE && self->settings
-      && g_settings_get_boolean (self->settings, "show-preview"))
+  if (type == CLIPMAN_ITEM_TYPE_IMAGE && show_previews (self))
     {
       GdkPixbuf *pixbuf = clipman_item_get_pixbuf (item);
       if (pixbuf)
         {
           gint width = gdk_pixbuf_get_width (pixbuf);
           gint height = gdk_pixbuf_get_height (pixbuf);
-          gint max_size = 48;
+          gint max_size = CLIPMAN_THUMBNAIL_SIZE;
 
           if (width > max_size || height > max_size)
             {
               gdouble scale = MIN ((gdouble)max_size / width,
                                    (gdouble)max_size / height);
-              GdkPixbuf *scaled = gdk_pixbuf_scale_simple (
+              thumbnail = gdk_pixbuf_scale_simple (
                   pixbuf, (gint)(width * scale), (gint)(height * scale),
                   GDK_INTERP_BILINEAR);
-              gtk_image_set_from_pixbuf (GTK_IMAGE (image), scaled);
-              g_object_unref (scaled);
             }
           else
             {
-              gtk_image_set_from_pixbuf (GTK_IMAGE (image), pixbuf);
+              thumbnail = g_object_ref (pixbuf);
             }
         }
     }
 
-  /* Label */
-  label = gtk_label_new (clipman_item_get_label (item));
-  gtk_label_set_xalign (GTK_LABEL (label), 0.0);
-  gtk_label_set_ellipsize (GTK_LABEL (label), PANGO_ELLIPSIZE_END);
-  gtk_widget_set_hexpand (label, TRUE);
-  gtk_box_pack_start (GTK_BOX (box), label, TRUE, TRUE, 0);
+  row = create_row (self, clipman_item_get_id (item), type,
+                    clipman_item_get_label (item), thumbnail);
+  g_object_set_data_full (G_OBJECT (row), "item", g_object_ref (item),
+                          g_object_unref);
 
-  /* Delete button */
-  delete_btn = gtk_button_new_from_icon_name ("edit-delete-symbolic",
-                                              GTK_ICON_SIZE_BUTTON);
-  gtk_button_set_relief (GTK_BUTTON (delete_btn), GTK_RELIEF_NONE);
-  gtk_widget_set_tooltip_text (delete_btn, _ ("Delete this item"));
-  g_object_set_data (G_OBJECT (delete_btn), "item-id",
-                     GINT_TO_POINTER ((gint)clipman_item_get_id (item)));
-  gtk_box_pack_end (GTK_BOX (box), delete_btn, FALSE, FALSE, 0);
+  g_clear_object (&thumbnail);
 
-  gtk_widget_show_all (row);
+  return row;
+}
+
+static GtkWidget *
+create_snapshot_row (ClipmanHistory *self, ClipmanSnapshotItem *item)
+{
+  GdkPixbuf *thumbnail = NULL;
+  GtkWidget *row;
+
+  /* Snapshot thumbnails are already scaled down */
+  if (item->thumbnail && show_previews (self))
+    {
+      GInputStream *stream = g_memory_input_stream_new_from_data (
+          item->thumbnail, item->thumbnail_size, NULL);
+
+      thumbnail = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
+      g_object_unref (stream);
+    }
+
+  row = create_row (self, item->id, item->type, item->label, thumbnail);
+
+  g_clear_object (&thumbnail);
 
   return row;
 }
@@ -189,6 +244,20 @@ on_row_activated (GtkListBox *box, GtkListBoxRow *row, gpointer user_data)
       g_signal_emit (self, signals[SIGNAL_ITEM_SELECTED], 0, item);
       gtk_widget_hide (GTK_WIDGET (self));
     }
+  else if (self->storage)
+    {
+      /* Rows drawn from the snapshot carry only the id */
+      gint64 id
+          = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (row), "item-id"));
+
+      item = clipman_storage_get_item (self->storage, id);
+      if (item)
+        {
+          g_signal_emit (self, signals[SIGNAL_ITEM_SELECTED], 0, item);
+          gtk_widget_hide (GTK_WIDGET (self));
+          g_object_unref (item);
+        }
+    }
 }
 
 static void
@@ -229,21 +298,29 @@ on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
 }
 
 static void
-on_search_changed (GtkSearchEntry *entry, gpointer user_data)
+append_row (ClipmanHistory *self, GtkWidget *row)
 {
-  ClipmanHistory *self = CLIPMAN_HISTORY (user_data);
-  const gchar *text;
-  GList *items, *l;
-  gint limit;
-
-  text = gtk_entry_get_text (GTK_ENTRY (entry));
+  /* Connect delete button */
+  GtkWidget *box = gtk_bin_get_child (GTK_BIN (row));
+  GList *children = gtk_container_get_children (GTK_CONTAINER (box));
+  for (GList *c = children; c; c = c->next)
+    {
+      if (GTK_IS_BUTTON (c->data))
+        {
+          g_signal_connect (c->data, "clicked",
+                            G_CALLBACK (on_delete_clicked), self);
+        }
+    }
+  g_list_free (children);
 
-  /* Clear current items */
-  gtk_container_foreach (GTK_CONTAINER (self->list_box),
-                         (GtkCallback)gtk_widget_destroy, NULL);
+  gtk_list_box_insert (GTK_LIST_BOX (self->list_box), row, -1);
+}
 
-  limit = self->settings ? g_settings_get_int (self->settings, "history-size")
-                         : 50;
+static gint
+append_items (ClipmanHistory *self, const gchar *text, gint limit)
+{
+  GList *items, *l;
+  gint n_rows = 0;
 
   if (text && strlen (text) > 0)
     {
@@ -254,38 +331,116 @@ on_search_changed (GtkSearchEntry *entry, gpointer user_data)
       items = clipman_storage_get_items (self->storage, limit);
     }
 
-  if (!items || g_list_length (items) == 0)
+  for (l = items; l; l = l->next)
     {
-      gtk_stack_set_visible_child_name (GTK_STACK (self->stack), "empty");
-      if (items)
-        g_list_free (items);
-      return;
+      append_row (self, create_item_row (self, l->data));
+      n_rows++;
     }
 
-  gtk_stack_set_visible_child_name (GTK_STACK (self->stack), "list");
+  g_list_free_full (items, g_object_unref);
 
-  for (l = items; l; l = l->next)
+  return n_rows;
+}
+
+static gint
+append_snapshot (ClipmanHistory *self, const gchar *text, gint limit)
+{
+  ClipmanSnapshot *snapshot;
+  gchar *path;
+  gchar *needle = NULL;
+  gint n_rows = 0;
+
+  path = clipman_snapshot_get_default_path ();
+  snapshot = clipman_snapshot_open (path, NULL);
+  g_free (path);
+
+  if (!snapshot)
+    return 0;
+
+  if (text && strlen (text) > 0)
+    needle = g_utf8_casefold (text, -1);
+
+  for (guint i = 0;
+       i < clipman_snapshot_get_n_items (snapshot) && n_rows < limit; i++)
     {
-      ClipmanItem *item = l->data;
-      GtkWidget *row = create_item_row (self, item);
+      ClipmanSnapshotItem item;
 
-      /* Connect delete button */
-      GtkWidget *box = gtk_bin_get_child (GTK_BIN (row));
-      GList *children = gtk_container_get_children (GTK_CONTAINER (box));
-      for (GList *c = children; c; c = c->next)
+      clipman_snapshot_get_item (snapshot, i, &item);
+
+      /* Only labels are available until the database is open */
+      if (needle)
         {
-          if (GTK_IS_BUTTON (c->data))
-            {
-              g_signal_connect (c->data, "clicked",
-                                G_CALLBACK (on_delete_clicked), self);
-            }
+          gchar *label = g_utf8_casefold (item.label, -1);
+          gboolean match = strstr (label, needle) != NULL;
+
+          g_free (label);
+          if (!match)
+            continue;
         }
-      g_list_free (children);
 
-      gtk_list_box_insert (GTK_LIST_BOX (self->list_box), row, -1);
+      append_row (self, create_snapshot_row (self, &item));
+      n_rows++;
     }
 
-  g_list_free_full (items, g_object_unref);
+  g_free (needle);
+  clipman_snapshot_free (snapshot);
+
+  return n_rows;
+}
+
+static void
+on_search_changed (GtkSearchEntry *entry, gpointer user_data)
+{
+  ClipmanHistory *self = CLIPMAN_HISTORY (user_data);
+  const gchar *text;
+  gint limit;
+  gint n_rows;
+
+  text = gtk_entry_get_text (GTK_ENTRY (entry));
+
+  /* Clear current items */
+  gtk_container_foreach (GTK_CONTAINER (self->list_box),
+                         (GtkCallback)gtk_widget_destroy, NULL);
+
+  limit = self->settings ? g_settings_get_int (self->settings, "history-size")
+                         : 50;
+
+  /* Until the storage is ready the popup is drawn from the snapshot of
+   * recent items, and reloaded from the database once it is */
+  if (self->storage)
+    n_rows = append_items (self, text, limit);
+  else
+    n_rows = append_snapshot (self, text, limit);
+
+  gtk_stack_set_visible_child_name (GTK_STACK (self->stack),
+                                    n_rows > 0 ? "list" : "empty");
+}
+
+static gboolean
+on_reload_idle (gpointer user_data)
+{
+  ClipmanHistory *self = CLIPMAN_HISTORY (user_data);
+
+  self->reload_id = 0;
+
+  /* Reload the current view, keeping any search text */
+  if (gtk_widget_get_visible (GTK_WIDGET (self)))
+    {
+      gint64 start = g_get_monotonic_time ();
+
+      on_search_changed (GTK_SEARCH_ENTRY (self->search_entry), self);
+      clipman_latency_record (CLIPMAN_STAGE_REFRESH, start);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+on_storage_changed (ClipmanHistory *self)
+{
+  /* Bursts of changes, e.g. from another instance, reload only once */
+  if (self->reload_id == 0)
+    self->reload_id = g_idle_add (on_reload_idle, self);
 }
 
 static gboolean
@@ -418,17 +573,44 @@ clipman_history_new (ClipmanStorage *storage, GSettings *settings)
 {
   ClipmanHistory *self;
 
-  g_return_val_if_fail (CLIPMAN_IS_STORAGE (storage), NULL);
+  g_return_val_if_fail (storage == NULL || CLIPMAN_IS_STORAGE (storage),
+                        NULL);
 
   self = g_object_new (CLIPMAN_TYPE_HISTORY, NULL);
-  self->storage = g_object_ref (storage);
 
   if (settings)
     self->settings = g_object_ref (settings);
 
+  if (storage)
+    clipman_history_set_storage (self, storage);
+
   return self;
 }
 
+void
+clipman_history_set_storage (ClipmanHistory *self, ClipmanStorage *storage)
+{
+  g_return_if_fail (CLIPMAN_IS_HISTORY (self));
+  g_return_if_fail (CLIPMAN_IS_STORAGE (storage));
+  g_return_if_fail (self->storage == NULL);
+
+  self->storage = g_object_ref (storage);
+
+  /* Keep an open popup in sync with changes from this and other
+   * processes */
+  g_signal_connect_swapped (storage, "item-added",
+                            G_CALLBACK (on_storage_changed), self);
+  g_signal_connect_swapped (storage, "item-removed",
+                            G_CALLBACK (on_storage_changed), self);
+  g_signal_connect_swapped (storage, "cleared",
+                            G_CALLBACK (on_storage_changed), self);
+  g_signal_connect_swapped (storage, "changed",
+                            G_CALLBACK (on_storage_changed), self);
+
+  /* Replace rows drawn from the snapshot */
+  on_storage_changed (self);
+}
+
 void
 clipman_history_show_popup (ClipmanHistory *self)
 {
@@ -485,3 +667,16 @@ clipman_history_refresh (ClipmanHistory *self)
   gtk_entry_set_text (GTK_ENTRY (self->search_entry), "");
   on_search_changed (GTK_SEARCH_ENTRY (self->search_entry), self);
 }
+
+void
+clipman_history_release_rows (ClipmanHistory *self)
+{
+  g_return_if_fail (CLIPMAN_IS_HISTORY (self));
+
+  /* Rows are rebuilt every time the popup is shown */
+  if (gtk_widget_get_visible (GTK_WIDGET (self)))
+    return;
+
+  gtk_container_foreach (GTK_CONTAINER (self->list_box),
+                         (GtkCallback)gtk_widget_destroy, NULL);
+}
@@ -37,6 +37,7 @@ struct _ClipmanItem
   ClipmanSource source;
   gchar *text;
   GdkPixbuf *pixbuf;
+  GBytes *png;
   gchar **uris;
   gchar *checksum;
   gchar *label;
@@ -68,6 +69,7 @@ clipman_item_finalize (GObject *object)
   g_free (self->checksum);
   g_free (self->label);
   g_clear_object (&self->pixbuf);
+  g_clear_pointer (&self->png, g_bytes_unref);
   g_strfreev (self->uris);
   g_clear_pointer (&self->timestamp, g_date_time_unref);
 
@@ -208,6 +210,7 @@ ClipmanItem *
 clipman_item_new_text (const gchar *text, ClipmanSource source)
 {
   ClipmanItem *self;
+  gint64 start;
 
   g_return_val_if_fail (text != NULL, NULL);
 
@@ -215,7 +218,11 @@ clipman_item_new_text (const gchar *text, ClipmanSource source)
   self->type = CLIPMAN_ITEM_TYPE_TEXT;
   self->source = source;
   self->text = g_strdup (text);
+
+  start = g_get_monotonic_time ();
   self->checksum = compute_checksum (text, strlen (text));
+  clipman_latency_record (CLIPMAN_STAGE_HASH, start);
+
   self->label = create_label (text, 50);
 
   return self;
@@ -228,6 +235,8 @@ clipman_item_new_image (GdkPixbuf *pixbuf, ClipmanSource source)
   gchar *buffer = NULL;
   gsize size = 0;
   GError *error = NULL;
+  gint64 start;
+  gboolean encoded;
 
   g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), NULL);
 
@@ -236,11 +245,18 @@ clipman_item_new_image (GdkPixbuf *pixbuf, ClipmanSource source)
   self->source = source;
   self->pixbuf = g_object_ref (pixbuf);
 
-  /* Generate checksum from PNG data */
-  if (gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &size, "png", &error, NULL))
+  /* Generate checksum from PNG data, kept for storage to reuse */
+  start = g_get_monotonic_time ();
+  encoded = gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &size, "png", &error,
+                                       NULL);
+  clipman_latency_record (CLIPMAN_STAGE_ENCODE, start);
+
+  if (encoded)
     {
+      start = g_get_monotonic_time ();
       self->checksum = compute_checksum (buffer, size);
-      g_free (buffer);
+      clipman_latency_record (CLIPMAN_STAGE_HASH, start);
+      self->png = g_bytes_new_take (buffer, size);
     }
   else
     {
@@ -265,6 +281,7 @@ clipman_item_new_files (gchar **uris, ClipmanSource source)
   ClipmanItem *self;
   GString *joined;
   guint count;
+  gint64 start;
 
   g_return_val_if_fail (uris != NULL, NULL);
 
@@ -284,7 +301,10 @@ clipman_item_new_files (gchar **uris, ClipmanSource source)
       count++;
     }
   self->text = g_string_free (g_string_new (joined->str), FALSE);
+
+  start = g_get_monotonic_time ();
   self->checksum = compute_checksum (joined->str, joined->len);
+  clipman_latency_record (CLIPMAN_STAGE_HASH, start);
 
   if (count == 1)
     {
@@ -302,6 +322,42 @@ clipman_item_new_files (gchar **uris, ClipmanSource source)
   return self;
 }
 
+/* Rebuilds an item read back from storage, which already has its checksum
+ * and label, so nothing is hashed or encoded again.  TEXT holds the text,
+ * or the URIs of files one per line; PIXBUF the image. */
+ClipmanItem *
+clipman_item_new_stored (ClipmanItemType type, ClipmanSource source,
+                         const gchar *checksum, const gchar *label,
+                         const gchar *text, GdkPixbuf *pixbuf)
+{
+  ClipmanItem *self;
+
+  g_return_val_if_fail (checksum != NULL, NULL);
+  g_return_val_if_fail (type == CLIPMAN_ITEM_TYPE_IMAGE
+                            ? GDK_IS_PIXBUF (pixbuf)
+                            : text != NULL,
+                        NULL);
+
+  self = g_object_new (CLIPMAN_TYPE_ITEM, NULL);
+  self->type = type;
+  self->source = source;
+  self->checksum = g_strdup (checksum);
+  self->label = g_strdup (label ? label : "");
+
+  if (type == CLIPMAN_ITEM_TYPE_IMAGE)
+    {
+      self->pixbuf = g_object_ref (pixbuf);
+    }
+  else
+    {
+      self->text = g_strdup (text);
+      if (type == CLIPMAN_ITEM_TYPE_FILES)
+        self->uris = g_strsplit (text, "\n", -1);
+    }
+
+  return self;
+}
+
 ClipmanItemType
 clipman_item_get_item_type (ClipmanItem *self)
 {
@@ -323,6 +379,13 @@ clipman_item_get_pixbuf (ClipmanItem *self)
   return self->pixbuf;
 }
 
+GBytes *
+clipman_item_get_png (ClipmanItem *self)
+{
+  g_return_val_if_fail (CLIPMAN_IS_ITEM (self), NULL);
+  return self->png;
+}
+
 gchar **
 clipman_item_get_uris (ClipmanItem *self)
 {
@@ -372,6 +435,23 @@ clipman_item_set_id (ClipmanItem *self, gint64 id)
   self->id = id;
 }
 
+/* Items read back from storage keep the time they were copied */
+void
+clipman_item_set_timestamp (ClipmanItem *self, gint64 unix_time)
+{
+  GDateTime *timestamp;
+
+  g_return_if_fail (CLIPMAN_IS_ITEM (self));
+
+  timestamp = g_date_time_new_from_unix_local (unix_time);
+  if (!timestamp)
+    return;
+
+  g_clear_pointer (&self->timestamp, g_date_time_unref);
+  self->timestamp = timestamp;
+}
+
+#ifndef CLIPMAN_HEADLESS
 void
 clipman_item_to_clipboard (ClipmanItem *self, GtkClipboard *clipboard)
 {
@@ -392,6 +472,7 @@ clipman_item_to_clipboard (ClipmanItem *self, GtkClipboard *clipboard)
       break;
     }
 }
+#endif
 
 gboolean
 clipman_item_equals (ClipmanItem *self, ClipmanItem *other)
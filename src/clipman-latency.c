@@ -0,0 +1,137 @@
+/*
+ * clipman-latency.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ * 
+ * Copyright 2025 Kerem Soke
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include "clipman.h"
+#include "config.h"
+
+/*
+ * Histograms of how long each stage of storing a copy takes.  Timing a
+ * stage costs two clock reads, at its start and in
+ * clipman_latency_record(), and one atomic increment, so it is always on;
+ * the counts are only summed up when someone asks for them.
+ */
+
+static const gchar *const stage_names[CLIPMAN_N_STAGES] = {
+  "fetch", "hash", "encode", "commit", "refresh",
+};
+
+static gint histograms[CLIPMAN_N_STAGES][CLIPMAN_LATENCY_BUCKETS];
+
+void
+clipman_latency_record (ClipmanStage stage, gint64 start)
+{
+  gint64 elapsed = g_get_monotonic_time () - start;
+  guint bucket = elapsed > 0 ? g_bit_storage ((gulong)elapsed) : 0;
+
+  g_return_if_fail (stage < CLIPMAN_N_STAGES);
+
+  g_atomic_int_inc (
+      &histograms[stage][MIN (bucket, CLIPMAN_LATENCY_BUCKETS - 1)]);
+}
+
+/* Maps each stage name to its bucket counts */
+GVariant *
+clipman_latency_to_variant (void)
+{
+  GVariantBuilder builder;
+  guint i, j;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sat}"));
+
+  for (i = 0; i < CLIPMAN_N_STAGES; i++)
+    {
+      guint64 counts[CLIPMAN_LATENCY_BUCKETS];
+
+      for (j = 0; j < CLIPMAN_LATENCY_BUCKETS; j++)
+        counts[j] = (guint) g_atomic_int_get (&histograms[i][j]);
+
+      g_variant_builder_add (
+          &builder, "{s@at}", stage_names[i],
+          g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, counts,
+                                     CLIPMAN_LATENCY_BUCKETS,
+                                     sizeof (guint64)));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Upper bound in microseconds of the bucket holding fraction P */
+static guint64
+percentile (const guint64 *counts, guint64 total, gdouble p)
+{
+  guint64 seen = 0;
+  guint i;
+
+  for (i = 0; i < CLIPMAN_LATENCY_BUCKETS; i++)
+    {
+      seen += counts[i];
+      if (seen > 0 && seen >= p * total)
+        break;
+    }
+
+  return G_GUINT64_CONSTANT (1) << MIN (i, CLIPMAN_LATENCY_BUCKETS - 1);
+}
+
+/* One line per stage with the count and percentiles, rounded up to the
+ * bucket bounds */
+gchar *
+clipman_latency_to_string (void)
+{
+  GString *string = g_string_new (NULL);
+  guint i, j;
+
+  g_string_append_printf (string, "%-8s %8s %10s %10s %10s %10s\n", "stage",
+                          "count", "p50_us", "p90_us", "p99_us", "max_us");
+
+  for (i = 0; i < CLIPMAN_N_STAGES; i++)
+    {
+      guint64 counts[CLIPMAN_LATENCY_BUCKETS];
+      guint64 total = 0;
+
+      for (j = 0; j < CLIPMAN_LATENCY_BUCKETS; j++)
+        {
+          counts[j] = (guint) g_atomic_int_get (&histograms[i][j]);
+          total += counts[j];
+        }
+
+      if (total == 0)
+        {
+          g_string_append_printf (string, "%-8s %8d\n", stage_names[i], 0);
+          continue;
+        }
+
+      g_string_append_printf (
+          string,
+          "%-8s %8" G_GUINT64_FORMAT " <%9" G_GUINT64_FORMAT
+          " <%9" G_GUINT64_FORMAT " <%9" G_GUINT64_FORMAT
+          " <%9" G_GUINT64_FORMAT "\n",
+          stage_names[i], total, percentile (counts, total, 0.5),
+          percentile (counts, total, 0.9), percentile (counts, total, 0.99),
+          percentile (counts, total, 1.0));
+    }
+
+  return g_string_free (string, FALSE);
+}
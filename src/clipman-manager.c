@@ -32,16 +32,22 @@ struct _ClipmanManager
 {
   GObject parent;
 
+  GdkDisplay *display;
   GtkClipboard *clipboard;
   GtkClipboard *primary;
   GSettings *settings;
 
-  guint check_timeout_id;
+  guint check_idle_id;
   gchar *last_clipboard_checksum;
   gchar *last_primary_checksum;
 
   gboolean running;
   gboolean ignore_next;
+
+  /* Optional trace of owner changes, for replaying workloads */
+  GOutputStream *trace;
+  guint8 trace_key[32];
+  gint64 change_time;
 };
 
 G_DEFINE_TYPE (ClipmanManager, clipman_manager, G_TYPE_OBJECT)
@@ -60,12 +66,14 @@ clipman_manager_finalize (GObject *object)
 {
   ClipmanManager *self = CLIPMAN_MANAGER (object);
 
-  if (self->check_timeout_id > 0)
-    g_source_remove (self->check_timeout_id);
+  if (self->check_idle_id > 0)
+    g_source_remove (self->check_idle_id);
 
   g_free (self->last_clipboard_checksum);
   g_free (self->last_primary_checksum);
   g_clear_object (&self->settings);
+  g_clear_object (&self->display);
+  g_clear_object (&self->trace);
 
   G_OBJECT_CLASS (clipman_manager_parent_class)->finalize (object);
 }
@@ -89,20 +97,39 @@ clipman_manager_class_init (ClipmanManagerClass *klass)
 static void
 clipman_manager_init (ClipmanManager *self)
 {
-  GdkDisplay *display = gdk_display_get_default ();
+  self->running = FALSE;
+  self->ignore_next = FALSE;
+}
 
+ClipmanManager *
+clipman_manager_new (void)
+{
+  return clipman_manager_new_for_display (gdk_display_get_default ());
+}
+
+ClipmanManager *
+clipman_manager_new_for_display (GdkDisplay *display)
+{
+  ClipmanManager *self;
+
+  g_return_val_if_fail (GDK_IS_DISPLAY (display), NULL);
+
+  self = g_object_new (CLIPMAN_TYPE_MANAGER, NULL);
+  self->display = g_object_ref (display);
   self->clipboard
       = gtk_clipboard_get_for_display (display, GDK_SELECTION_CLIPBOARD);
   self->primary
       = gtk_clipboard_get_for_display (display, GDK_SELECTION_PRIMARY);
-  self->running = FALSE;
-  self->ignore_next = FALSE;
+
+  return self;
 }
 
-ClipmanManager *
-clipman_manager_new (void)
+GdkDisplay *
+clipman_manager_get_display (ClipmanManager *self)
 {
-  return g_object_new (CLIPMAN_TYPE_MANAGER, NULL);
+  g_return_val_if_fail (CLIPMAN_IS_MANAGER (self), NULL);
+
+  return self->display;
 }
 
 void
@@ -115,6 +142,58 @@ clipman_manager_set_settings (ClipmanManager *self, GSettings *settings)
   self->settings = g_object_ref (settings);
 }
 
+void
+clipman_manager_set_trace (ClipmanManager *self, GOutputStream *stream)
+{
+  guint i;
+
+  g_return_if_fail (CLIPMAN_IS_MANAGER (self));
+  g_return_if_fail (stream == NULL || G_IS_OUTPUT_STREAM (stream));
+
+  g_clear_object (&self->trace);
+  if (!stream)
+    return;
+
+  self->trace = g_object_ref (stream);
+  for (i = 0; i < sizeof (self->trace_key); i++)
+    self->trace_key[i] = g_random_int_range (0, 256);
+}
+
+/* Writes one owner change to the trace. Content is never written, only
+ * its size and a hash keyed per trace, which tells repeated copies from
+ * new ones without revealing what was copied. */
+static void
+record_trace (ClipmanManager *self, GtkClipboard *clipboard,
+              const gchar *type, const guchar *data, gsize size, gint width,
+              gint height, guint count)
+{
+  gchar *hash;
+  GError *error = NULL;
+
+  if (!self->trace || self->change_time == 0)
+    return;
+
+  hash = g_compute_hmac_for_data (G_CHECKSUM_SHA256, self->trace_key,
+                                  sizeof (self->trace_key), data, size);
+  hash[16] = '\0';
+
+  /* time_us selection type bytes width height count hash */
+  if (!g_output_stream_printf (
+          self->trace, NULL, NULL, &error,
+          "%" G_GINT64_FORMAT "\t%s\t%s\t%" G_GSIZE_FORMAT
+          "\t%d\t%d\t%u\t%s\n",
+          self->change_time,
+          clipboard == self->primary ? "primary" : "clipboard", type, size,
+          width, height, count, hash))
+    {
+      g_warning ("Failed to write clipboard trace: %s", error->message);
+      g_error_free (error);
+      g_clear_object (&self->trace);
+    }
+
+  g_free (hash);
+}
+
 static void
 process_text (ClipmanManager *self, GtkClipboard *clipboard, const gchar *text)
 {
@@ -214,6 +293,14 @@ process_uris (ClipmanManager *self, GtkClipboard *clipboard, gchar **uris)
   g_object_unref (item);
 }
 
+/* The initial check has no owner change to time the fetch from */
+static void
+record_fetch (ClipmanManager *self)
+{
+  if (self->change_time > 0)
+    clipman_latency_record (CLIPMAN_STAGE_FETCH, self->change_time);
+}
+
 static void
 check_clipboard_content (ClipmanManager *self, GtkClipboard *clipboard)
 {
@@ -223,6 +310,16 @@ check_clipboard_content (ClipmanManager *self, GtkClipboard *clipboard)
   uris = gtk_clipboard_wait_for_uris (clipboard);
   if (uris && uris[0])
     {
+      record_fetch (self);
+      if (self->trace)
+        {
+          gchar *list = g_strjoinv ("\n", uris);
+
+          record_trace (self, clipboard, "files", (const guchar *)list,
+                        strlen (list), 0, 0, g_strv_length (uris));
+          g_free (list);
+        }
+
       process_uris (self, clipboard, uris);
       g_strfreev (uris);
       return;
@@ -235,6 +332,12 @@ check_clipboard_content (ClipmanManager *self, GtkClipboard *clipboard)
       GdkPixbuf *pixbuf = gtk_clipboard_wait_for_image (clipboard);
       if (pixbuf)
         {
+          record_fetch (self);
+          record_trace (self, clipboard, "image",
+                        gdk_pixbuf_read_pixels (pixbuf),
+                        gdk_pixbuf_get_byte_length (pixbuf),
+                        gdk_pixbuf_get_width (pixbuf),
+                        gdk_pixbuf_get_height (pixbuf), 0);
           process_image (self, clipboard, pixbuf);
           g_object_unref (pixbuf);
           return;
@@ -247,6 +350,9 @@ check_clipboard_content (ClipmanManager *self, GtkClipboard *clipboard)
       gchar *text = gtk_clipboard_wait_for_text (clipboard);
       if (text)
         {
+          record_fetch (self);
+          record_trace (self, clipboard, "text", (const guchar *)text,
+                        strlen (text), 0, 0, 0);
           process_text (self, clipboard, text);
           g_free (text);
           return;
@@ -254,6 +360,7 @@ check_clipboard_content (ClipmanManager *self, GtkClipboard *clipboard)
     }
 
   /* Clipboard is empty */
+  record_trace (self, clipboard, "empty", NULL, 0, 0, 0, 0);
   ClipmanSource source = (clipboard == self->primary)
                              ? CLIPMAN_SOURCE_PRIMARY
                              : CLIPMAN_SOURCE_CLIPBOARD;
@@ -276,7 +383,20 @@ on_owner_change (GtkClipboard *clipboard, GdkEvent *event, gpointer user_data)
         return;
     }
 
+  self->change_time = g_get_monotonic_time ();
   check_clipboard_content (self, clipboard);
+  self->change_time = 0;
+}
+
+static gboolean
+on_initial_check (gpointer user_data)
+{
+  ClipmanManager *self = CLIPMAN_MANAGER (user_data);
+
+  self->check_idle_id = 0;
+  check_clipboard_content (self, self->clipboard);
+
+  return G_SOURCE_REMOVE;
 }
 
 void
@@ -294,8 +414,9 @@ clipman_manager_start (ClipmanManager *self)
   g_signal_connect (self->primary, "owner-change",
                     G_CALLBACK (on_owner_change), self);
 
-  /* Initial check */
-  check_clipboard_content (self, self->clipboard);
+  /* The initial check waits for the clipboard owner, so keep it out of
+   * startup and run it once the main loop is idle */
+  self->check_idle_id = g_idle_add (on_initial_check, self);
 }
 
 void
@@ -308,6 +429,12 @@ clipman_manager_stop (ClipmanManager *self)
 
   self->running = FALSE;
 
+  if (self->check_idle_id > 0)
+    {
+      g_source_remove (self->check_idle_id);
+      self->check_idle_id = 0;
+    }
+
   g_signal_handlers_disconnect_by_func (self->clipboard, on_owner_change,
                                         self);
   g_signal_handlers_disconnect_by_func (self->primary, on_owner_change, self);
@@ -43,6 +43,8 @@ struct _ClipmanPreferences
   GtkWidget *confirm_clear_check;
   GtkWidget *paste_on_select_check;
   GtkWidget *exclude_pattern_entry;
+  GtkWidget *backup_interval_spin;
+  GtkWidget *backup_count_spin;
 };
 
 G_DEFINE_TYPE (ClipmanPreferences, clipman_preferences, GTK_TYPE_DIALOG)
@@ -220,6 +222,34 @@ clipman_preferences_init (ClipmanPreferences *self)
   gtk_box_pack_start (GTK_BOX (vbox), create_indented_widget (box), FALSE,
                       FALSE, 0);
 
+  /* Backup section */
+  gtk_box_pack_start (GTK_BOX (vbox), create_section_label (_ ("Backups")),
+                      FALSE, FALSE, 0);
+
+  grid = gtk_grid_new ();
+  gtk_grid_set_column_spacing (GTK_GRID (grid), 12);
+  gtk_grid_set_row_spacing (GTK_GRID (grid), 6);
+  gtk_box_pack_start (GTK_BOX (vbox), create_indented_widget (grid), FALSE,
+                      FALSE, 0);
+
+  label = gtk_label_new (_ ("Backup interval (minutes):"));
+  gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+  gtk_grid_attach (GTK_GRID (grid), label, 0, 0, 1, 1);
+
+  self->backup_interval_spin = gtk_spin_button_new_with_range (0, 10080, 5);
+  gtk_widget_set_tooltip_text (self->backup_interval_spin,
+                               _ ("Set to 0 to disable backups"));
+  gtk_grid_attach (GTK_GRID (grid), self->backup_interval_spin, 1, 0, 1, 1);
+
+  label = gtk_label_new (_ ("Backups to keep:"));
+  gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+  gtk_grid_attach (GTK_GRID (grid), label, 0, 1, 1, 1);
+
+  self->backup_count_spin = gtk_spin_button_new_with_range (0, 20, 1);
+  gtk_widget_set_tooltip_text (self->backup_count_spin,
+                               _ ("Set to 0 to disable backups"));
+  gtk_grid_attach (GTK_GRID (grid), self->backup_count_spin, 1, 1, 1, 1);
+
   gtk_widget_show_all (vbox);
 
   g_signal_connect (self, "response", G_CALLBACK (gtk_widget_hide), NULL);
@@ -273,6 +303,16 @@ clipman_preferences_new (GtkWindow *parent, GSettings *settings)
       g_settings_bind (settings, "exclude-pattern",
                        self->exclude_pattern_entry, "text",
                        G_SETTINGS_BIND_DEFAULT);
+
+      g_settings_bind (settings, "backup-interval",
+                       gtk_spin_button_get_adjustment (
+                           GTK_SPIN_BUTTON (self->backup_interval_spin)),
+                       "value", G_SETTINGS_BIND_DEFAULT);
+
+      g_settings_bind (settings, "backup-count",
+                       gtk_spin_button_get_adjustment (
+                           GTK_SPIN_BUTTON (self->backup_count_spin)),
+                       "value", G_SETTINGS_BIND_DEFAULT);
     }
 
   return self;
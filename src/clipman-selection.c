@@ -0,0 +1,980 @@
+/*
+ * clipman-selection.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ * 
+ * Copyright 2025 Kerem Soke
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+/* Talks ICCCM directly: XFixes reports owner changes, the contents are
+ * fetched with XConvertSelection on a hidden window, and items are served
+ * back with XSetSelectionOwner.  Large transfers in both directions use
+ * the INCR protocol.  Everything is asynchronous and driven by the X
+ * connection's file descriptor, so the daemon never blocks on a slow
+ * selection owner. */
+
+#include "clipman.h"
+#include "config.h"
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xfixes.h>
+#include <glib-unix.h>
+
+/* Seconds a selection owner may take to answer a conversion */
+#define CONVERT_TIMEOUT 5
+
+/* Largest property written in one piece before switching to INCR */
+#define MAX_CHUNK_SIZE (256 * 1024)
+
+enum
+{
+  ATOM_CLIPBOARD,
+  ATOM_TARGETS,
+  ATOM_TIMESTAMP,
+  ATOM_INCR,
+  ATOM_UTF8_STRING,
+  ATOM_TEXT,
+  ATOM_TEXT_PLAIN_UTF8,
+  ATOM_TEXT_PLAIN,
+  ATOM_IMAGE_PNG,
+  ATOM_URI_LIST,
+  ATOM_GNOME_COPIED_FILES,
+  ATOM_CLIPMAN_CLIPBOARD,
+  ATOM_CLIPMAN_PRIMARY,
+  N_ATOMS
+};
+
+static char *atom_names[N_ATOMS] = {
+  "CLIPBOARD",
+  "TARGETS",
+  "TIMESTAMP",
+  "INCR",
+  "UTF8_STRING",
+  "TEXT",
+  "text/plain;charset=utf-8",
+  "text/plain",
+  "image/png",
+  "text/uri-list",
+  "x-special/gnome-copied-files",
+  "_CLIPMAN_CLIPBOARD",
+  "_CLIPMAN_PRIMARY",
+};
+
+typedef enum
+{
+  FETCH_IDLE,
+  FETCH_TARGETS,
+  FETCH_DATA
+} FetchState;
+
+/* PRIMARY or CLIPBOARD: the conversion in progress and the item we serve
+ * while we own it */
+typedef struct
+{
+  ClipmanSelection *self;
+  ClipmanSource source;
+  Atom selection;
+  Atom property;
+
+  FetchState state;
+  Atom target;
+  GByteArray *incr;
+  guint timeout_id;
+  gchar *last_checksum;
+  gint64 fetch_start;
+
+  ClipmanItem *owned;
+  Time owned_time;
+} Selection;
+
+/* Data being sent to a requestor in INCR chunks */
+typedef struct
+{
+  Window requestor;
+  Atom property;
+  Atom type;
+  GBytes *data;
+  gsize offset;
+} Transfer;
+
+struct _ClipmanSelection
+{
+  GObject parent;
+
+  Display *display;
+  Window window;
+  int xfixes_event_base;
+  Atom atoms[N_ATOMS];
+  gsize max_chunk;
+  Time last_time;
+
+  GSettings *settings;
+  guint watch_id;
+  gboolean running;
+
+  Selection selections[CLIPMAN_N_SOURCES];
+  GList *transfers;
+};
+
+G_DEFINE_TYPE (ClipmanSelection, clipman_selection, G_TYPE_OBJECT)
+
+enum
+{
+  SIGNAL_ITEM_RECEIVED,
+  SIGNAL_CLIPBOARD_EMPTY,
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+static void
+transfer_free (Transfer *transfer)
+{
+  g_bytes_unref (transfer->data);
+  g_free (transfer);
+}
+
+static void
+reset_fetch (Selection *sel)
+{
+  if (sel->timeout_id > 0)
+    {
+      g_source_remove (sel->timeout_id);
+      sel->timeout_id = 0;
+    }
+
+  if (sel->incr)
+    {
+      g_byte_array_unref (sel->incr);
+      sel->incr = NULL;
+    }
+
+  sel->state = FETCH_IDLE;
+}
+
+static void
+clipman_selection_finalize (GObject *object)
+{
+  ClipmanSelection *self = CLIPMAN_SELECTION (object);
+
+  for (guint i = 0; i < CLIPMAN_N_SOURCES; i++)
+    {
+      reset_fetch (&self->selections[i]);
+      g_free (self->selections[i].last_checksum);
+      g_clear_object (&self->selections[i].owned);
+    }
+
+  g_list_free_full (self->transfers, (GDestroyNotify)transfer_free);
+
+  if (self->watch_id > 0)
+    g_source_remove (self->watch_id);
+
+  if (self->window)
+    XDestroyWindow (self->display, self->window);
+  if (self->display)
+    XCloseDisplay (self->display);
+
+  g_clear_object (&self->settings);
+
+  G_OBJECT_CLASS (clipman_selection_parent_class)->finalize (object);
+}
+
+static void
+clipman_selection_class_init (ClipmanSelectionClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = clipman_selection_finalize;
+
+  signals[SIGNAL_ITEM_RECEIVED] = g_signal_new (
+      "item-received", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL,
+      NULL, NULL, G_TYPE_NONE, 1, CLIPMAN_TYPE_ITEM);
+
+  signals[SIGNAL_CLIPBOARD_EMPTY] = g_signal_new (
+      "clipboard-empty", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL,
+      NULL, NULL, G_TYPE_NONE, 1, G_TYPE_INT);
+}
+
+static void
+clipman_selection_init (ClipmanSelection *self)
+{
+  for (guint i = 0; i < CLIPMAN_N_SOURCES; i++)
+    {
+      self->selections[i].self = self;
+      self->selections[i].source = i;
+    }
+}
+
+static int
+on_x_error (Display *display, XErrorEvent *event)
+{
+  /* Requestors may go away in the middle of a transfer; that must not
+   * take the daemon down like Xlib's default handler would */
+  g_debug ("X error %d on request %d", event->error_code,
+           event->request_code);
+
+  return 0;
+}
+
+static Selection *
+find_selection (ClipmanSelection *self, Atom selection)
+{
+  for (guint i = 0; i < CLIPMAN_N_SOURCES; i++)
+    {
+      if (self->selections[i].selection == selection)
+        return &self->selections[i];
+    }
+
+  return NULL;
+}
+
+static gboolean
+get_boolean_setting (ClipmanSelection *self, const gchar *key)
+{
+  return !self->settings || g_settings_get_boolean (self->settings, key);
+}
+
+static gboolean
+is_excluded (ClipmanSelection *self, const gchar *text)
+{
+  gchar *pattern;
+  GRegex *regex;
+  gboolean excluded = FALSE;
+
+  if (!self->settings)
+    return FALSE;
+
+  pattern = g_settings_get_string (self->settings, "exclude-pattern");
+  if (pattern && strlen (pattern) > 0)
+    {
+      regex = g_regex_new (pattern, 0, 0, NULL);
+      if (regex)
+        {
+          excluded = g_regex_match (regex, text, 0, NULL);
+          g_regex_unref (regex);
+        }
+    }
+  g_free (pattern);
+
+  return excluded;
+}
+
+static ClipmanItem *
+item_from_data (Selection *sel, const guint8 *data, gsize size)
+{
+  ClipmanSelection *self = sel->self;
+  ClipmanItem *item = NULL;
+  gchar *text;
+
+  if (sel->target == self->atoms[ATOM_URI_LIST])
+    {
+      gchar **uris;
+
+      text = g_strndup ((const gchar *)data, size);
+      uris = g_uri_list_extract_uris (text);
+      if (uris && uris[0])
+        item = clipman_item_new_files (uris, sel->source);
+      g_strfreev (uris);
+      g_free (text);
+    }
+  else if (sel->target == self->atoms[ATOM_IMAGE_PNG])
+    {
+      GdkPixbufLoader *loader = gdk_pixbuf_loader_new_with_type ("png", NULL);
+      gboolean ok;
+
+      if (loader)
+        {
+          ok = gdk_pixbuf_loader_write (loader, data, size, NULL);
+          ok = gdk_pixbuf_loader_close (loader, NULL) && ok;
+          if (ok)
+            item = clipman_item_new_image (
+                gdk_pixbuf_loader_get_pixbuf (loader), sel->source);
+          g_object_unref (loader);
+        }
+    }
+  else
+    {
+      /* STRING is Latin-1, the other text targets are UTF-8 */
+      if (sel->target == XA_STRING)
+        text = g_convert ((const gchar *)data, size, "UTF-8", "ISO-8859-1",
+                          NULL, NULL, NULL);
+      else if (g_utf8_validate ((const gchar *)data, size, NULL))
+        text = g_strndup ((const gchar *)data, size);
+      else
+        text = NULL;
+
+      if (text && strlen (text) > 0 && !is_excluded (self, text))
+        item = clipman_item_new_text (text, sel->source);
+      g_free (text);
+    }
+
+  return item;
+}
+
+static void
+finish_fetch (Selection *sel, const guint8 *data, gsize size)
+{
+  ClipmanItem *item;
+  const gchar *checksum;
+
+  reset_fetch (sel);
+
+  /* The fetch at start-up has no owner change to time it from */
+  if (sel->fetch_start > 0)
+    clipman_latency_record (CLIPMAN_STAGE_FETCH, sel->fetch_start);
+  sel->fetch_start = 0;
+
+  item = item_from_data (sel, data, size);
+  if (!item)
+    return;
+
+  /* Owners re-asserting the same content are not new items */
+  checksum = clipman_item_get_checksum (item);
+  if (g_strcmp0 (checksum, sel->last_checksum) != 0)
+    {
+      g_free (sel->last_checksum);
+      sel->last_checksum = g_strdup (checksum);
+      g_signal_emit (sel->self, signals[SIGNAL_ITEM_RECEIVED], 0, item);
+    }
+
+  g_object_unref (item);
+}
+
+static gboolean
+on_fetch_timeout (gpointer user_data)
+{
+  Selection *sel = user_data;
+
+  g_debug ("Selection owner did not answer in time");
+
+  sel->timeout_id = 0;
+  reset_fetch (sel);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+convert (Selection *sel, FetchState state, Atom target)
+{
+  ClipmanSelection *self = sel->self;
+
+  reset_fetch (sel);
+
+  sel->state = state;
+  sel->target = target;
+  sel->timeout_id
+      = g_timeout_add_seconds (CONVERT_TIMEOUT, on_fetch_timeout, sel);
+
+  XConvertSelection (self->display, sel->selection, target, sel->property,
+                     self->window, self->last_time);
+  XFlush (self->display);
+}
+
+static void
+choose_target (Selection *sel, const Atom *targets, gulong n_targets)
+{
+  ClipmanSelection *self = sel->self;
+  Atom preferred[5];
+  guint n_preferred = 0;
+
+  /* Files first, as file managers also offer their names as text */
+  if (get_boolean_setting (self, "save-files"))
+    preferred[n_preferred++] = self->atoms[ATOM_URI_LIST];
+  if (get_boolean_setting (self, "save-images"))
+    preferred[n_preferred++] = self->atoms[ATOM_IMAGE_PNG];
+  preferred[n_preferred++] = self->atoms[ATOM_UTF8_STRING];
+  preferred[n_preferred++] = self->atoms[ATOM_TEXT_PLAIN_UTF8];
+  preferred[n_preferred++] = XA_STRING;
+
+  for (guint i = 0; i < n_preferred; i++)
+    {
+      for (gulong j = 0; j < n_targets; j++)
+        {
+          if (targets[j] == preferred[i])
+            {
+              convert (sel, FETCH_DATA, preferred[i]);
+              return;
+            }
+        }
+    }
+
+  reset_fetch (sel);
+
+  if (n_targets == 0)
+    g_signal_emit (self, signals[SIGNAL_CLIPBOARD_EMPTY], 0, sel->source);
+}
+
+static void
+on_selection_notify (ClipmanSelection *self, XSelectionEvent *event)
+{
+  Selection *sel = find_selection (self, event->selection);
+  Atom type;
+  int format;
+  gulong n_items;
+  gulong bytes_after;
+  guchar *data = NULL;
+
+  if (!sel || sel->state == FETCH_IDLE || event->target != sel->target)
+    return;
+
+  if (event->property == None)
+    {
+      /* Owners without TARGETS support may still convert to text */
+      if (sel->state == FETCH_TARGETS)
+        convert (sel, FETCH_DATA, self->atoms[ATOM_UTF8_STRING]);
+      else
+        reset_fetch (sel);
+      return;
+    }
+
+  if (XGetWindowProperty (self->display, self->window, sel->property, 0,
+                          G_MAXLONG / 4, True, AnyPropertyType, &type,
+                          &format, &n_items, &bytes_after, &data)
+      != Success)
+    {
+      reset_fetch (sel);
+      return;
+    }
+
+  if (type == self->atoms[ATOM_INCR])
+    {
+      /* Deleting the property above asked the owner for the first chunk */
+      sel->incr = g_byte_array_new ();
+    }
+  else if (sel->state == FETCH_TARGETS)
+    {
+      /* 32-bit properties come back as arrays of long */
+      if (type == XA_ATOM && format == 32)
+        choose_target (sel, (const Atom *)data, n_items);
+      else
+        choose_target (sel, NULL, 0);
+    }
+  else if (format == 8)
+    {
+      finish_fetch (sel, data, n_items);
+    }
+  else
+    {
+      reset_fetch (sel);
+    }
+
+  if (data)
+    XFree (data);
+}
+
+static void
+on_incr_chunk (ClipmanSelection *self, Selection *sel)
+{
+  Atom type;
+  int format;
+  gulong n_items;
+  gulong bytes_after;
+  guchar *data = NULL;
+
+  if (XGetWindowProperty (self->display, self->window, sel->property, 0,
+                          G_MAXLONG / 4, True, AnyPropertyType, &type,
+                          &format, &n_items, &bytes_after, &data)
+      != Success)
+    {
+      reset_fetch (sel);
+      return;
+    }
+
+  /* An empty chunk ends the transfer */
+  if (n_items == 0)
+    {
+      GByteArray *incr = sel->incr;
+
+      sel->incr = NULL;
+      finish_fetch (sel, incr->data, incr->len);
+      g_byte_array_unref (incr);
+    }
+  else if (format == 8)
+    {
+      g_byte_array_append (sel->incr, data, n_items);
+    }
+
+  if (data)
+    XFree (data);
+}
+
+static void
+on_owner_change (ClipmanSelection *self, XFixesSelectionNotifyEvent *event)
+{
+  Selection *sel = find_selection (self, event->selection);
+
+  self->last_time = event->timestamp;
+
+  if (!sel || !self->running || event->owner == self->window)
+    return;
+
+  if (sel->source == CLIPMAN_SOURCE_PRIMARY
+      && (!self->settings
+          || !g_settings_get_boolean (self->settings,
+                                      "use-primary-selection")))
+    return;
+
+  /* The owner went away and took the content with it */
+  if (event->owner == None)
+    {
+      reset_fetch (sel);
+      g_signal_emit (self, signals[SIGNAL_CLIPBOARD_EMPTY], 0, sel->source);
+      return;
+    }
+
+  sel->fetch_start = g_get_monotonic_time ();
+  convert (sel, FETCH_TARGETS, self->atoms[ATOM_TARGETS]);
+}
+
+static GBytes *
+get_target_data (ClipmanSelection *self, ClipmanItem *item, Atom target,
+                 Atom *type)
+{
+  ClipmanItemType item_type = clipman_item_get_item_type (item);
+  const gchar *text = clipman_item_get_text (item);
+  gchar **uris;
+  GString *list;
+  gchar *buffer;
+  gsize size;
+
+  *type = target;
+
+  if (item_type == CLIPMAN_ITEM_TYPE_IMAGE)
+    {
+      if (target != self->atoms[ATOM_IMAGE_PNG]
+          || !gdk_pixbuf_save_to_buffer (clipman_item_get_pixbuf (item),
+                                         &buffer, &size, "png", NULL, NULL))
+        return NULL;
+
+      return g_bytes_new_take (buffer, size);
+    }
+
+  if (item_type == CLIPMAN_ITEM_TYPE_FILES
+      && (target == self->atoms[ATOM_URI_LIST]
+          || target == self->atoms[ATOM_GNOME_COPIED_FILES]))
+    {
+      gboolean nautilus = target == self->atoms[ATOM_GNOME_COPIED_FILES];
+
+      list = g_string_new (nautilus ? "copy" : NULL);
+      for (uris = clipman_item_get_uris (item); uris && *uris; uris++)
+        {
+          if (list->len > 0)
+            g_string_append (list, nautilus ? "\n" : "\r\n");
+          g_string_append (list, *uris);
+        }
+
+      return g_string_free_to_bytes (list);
+    }
+
+  if (!text)
+    return NULL;
+
+  if (target == XA_STRING)
+    {
+      buffer = g_convert_with_fallback (text, -1, "ISO-8859-1", "UTF-8", "?",
+                                        NULL, &size, NULL);
+      return buffer ? g_bytes_new_take (buffer, size) : NULL;
+    }
+
+  if (target == self->atoms[ATOM_TEXT])
+    *type = self->atoms[ATOM_UTF8_STRING];
+  else if (target != self->atoms[ATOM_UTF8_STRING]
+           && target != self->atoms[ATOM_TEXT_PLAIN_UTF8]
+           && target != self->atoms[ATOM_TEXT_PLAIN])
+    return NULL;
+
+  return g_bytes_new (text, strlen (text));
+}
+
+static void
+send_targets (ClipmanSelection *self, ClipmanItem *item, Window requestor,
+              Atom property)
+{
+  Atom targets[8];
+  guint n_targets = 0;
+
+  targets[n_targets++] = self->atoms[ATOM_TARGETS];
+  targets[n_targets++] = self->atoms[ATOM_TIMESTAMP];
+
+  if (clipman_item_get_item_type (item) == CLIPMAN_ITEM_TYPE_IMAGE)
+    {
+      targets[n_targets++] = self->atoms[ATOM_IMAGE_PNG];
+    }
+  else
+    {
+      if (clipman_item_get_item_type (item) == CLIPMAN_ITEM_TYPE_FILES)
+        {
+          targets[n_targets++] = self->atoms[ATOM_URI_LIST];
+          targets[n_targets++] = self->atoms[ATOM_GNOME_COPIED_FILES];
+        }
+      targets[n_targets++] = self->atoms[ATOM_UTF8_STRING];
+      targets[n_targets++] = self->atoms[ATOM_TEXT_PLAIN_UTF8];
+      targets[n_targets++] = XA_STRING;
+    }
+
+  XChangeProperty (self->display, requestor, property, XA_ATOM, 32,
+                   PropModeReplace, (guchar *)targets, n_targets);
+}
+
+static gboolean
+send_data (ClipmanSelection *self, ClipmanItem *item, Window requestor,
+           Atom property, Atom target)
+{
+  GBytes *data;
+  Atom type;
+  gsize size;
+
+  data = get_target_data (self, item, target, &type);
+  if (!data)
+    return FALSE;
+
+  size = g_bytes_get_size (data);
+  if (size <= self->max_chunk)
+    {
+      XChangeProperty (self->display, requestor, property, type, 8,
+                       PropModeReplace, g_bytes_get_data (data, NULL), size);
+      g_bytes_unref (data);
+    }
+  else
+    {
+      Transfer *transfer = g_new0 (Transfer, 1);
+      long incr_size = size;
+
+      /* The requestor deletes the property to ask for each chunk */
+      transfer->requestor = requestor;
+      transfer->property = property;
+      transfer->type = type;
+      transfer->data = data;
+      self->transfers = g_list_prepend (self->transfers, transfer);
+
+      XSelectInput (self->display, requestor, PropertyChangeMask);
+      XChangeProperty (self->display, requestor, property,
+                       self->atoms[ATOM_INCR], 32, PropModeReplace,
+                       (guchar *)&incr_size, 1);
+    }
+
+  return TRUE;
+}
+
+static void
+on_selection_request (ClipmanSelection *self, XSelectionRequestEvent *event)
+{
+  Selection *sel = find_selection (self, event->selection);
+  XSelectionEvent reply = { 0 };
+  Atom property;
+
+  /* Obsolete clients leave the property to the owner */
+  property = event->property != None ? event->property : event->target;
+
+  reply.type = SelectionNotify;
+  reply.display = self->display;
+  reply.requestor = event->requestor;
+  reply.selection = event->selection;
+  reply.target = event->target;
+  reply.property = None;
+  reply.time = event->time;
+
+  if (sel && sel->owned)
+    {
+      if (event->target == self->atoms[ATOM_TARGETS])
+        {
+          send_targets (self, sel->owned, event->requestor, property);
+          reply.property = property;
+        }
+      else if (event->target == self->atoms[ATOM_TIMESTAMP])
+        {
+          long timestamp = sel->owned_time;
+
+          XChangeProperty (self->display, event->requestor, property,
+                           XA_INTEGER, 32, PropModeReplace,
+                           (guchar *)&timestamp, 1);
+          reply.property = property;
+        }
+      else if (send_data (self, sel->owned, event->requestor, property,
+                          event->target))
+        {
+          reply.property = property;
+        }
+    }
+
+  XSendEvent (self->display, event->requestor, False, NoEventMask,
+              (XEvent *)&reply);
+  XFlush (self->display);
+}
+
+static void
+on_requestor_property (ClipmanSelection *self, XPropertyEvent *event)
+{
+  Transfer *transfer = NULL;
+  gsize size;
+  gsize chunk;
+
+  for (GList *l = self->transfers; l; l = l->next)
+    {
+      Transfer *t = l->data;
+
+      if (t->requestor == event->window && t->property == event->atom)
+        {
+          transfer = t;
+          break;
+        }
+    }
+
+  if (!transfer || event->state != PropertyDelete)
+    return;
+
+  /* The last, empty chunk tells the requestor the transfer is complete */
+  size = g_bytes_get_size (transfer->data);
+  chunk = MIN (size - transfer->offset, self->max_chunk);
+  XChangeProperty (self->display, transfer->requestor, transfer->property,
+                   transfer->type, 8, PropModeReplace,
+                   (const guchar *)g_bytes_get_data (transfer->data, NULL)
+                       + transfer->offset,
+                   chunk);
+  transfer->offset += chunk;
+
+  if (chunk == 0)
+    {
+      XSelectInput (self->display, transfer->requestor, NoEventMask);
+      self->transfers = g_list_remove (self->transfers, transfer);
+      transfer_free (transfer);
+    }
+
+  XFlush (self->display);
+}
+
+static void
+handle_event (ClipmanSelection *self, XEvent *event)
+{
+  Selection *sel;
+
+  if (event->type == self->xfixes_event_base + XFixesSelectionNotify)
+    {
+      on_owner_change (self, (XFixesSelectionNotifyEvent *)event);
+      return;
+    }
+
+  switch (event->type)
+    {
+    case SelectionNotify:
+      on_selection_notify (self, &event->xselection);
+      break;
+
+    case SelectionRequest:
+      on_selection_request (self, &event->xselectionrequest);
+      break;
+
+    case SelectionClear:
+      sel = find_selection (self, event->xselectionclear.selection);
+      if (sel)
+        g_clear_object (&sel->owned);
+      break;
+
+    case PropertyNotify:
+      if (event->xproperty.window != self->window)
+        {
+          on_requestor_property (self, &event->xproperty);
+          break;
+        }
+
+      self->last_time = event->xproperty.time;
+      for (guint i = 0; i < CLIPMAN_N_SOURCES; i++)
+        {
+          sel = &self->selections[i];
+          if (sel->incr && event->xproperty.atom == sel->property
+              && event->xproperty.state == PropertyNewValue)
+            on_incr_chunk (self, sel);
+        }
+      break;
+
+    default:
+      break;
+    }
+}
+
+/* Round trips may queue events without the socket becoming readable again,
+ * so drain the queue after every batch of requests */
+static void
+dispatch_events (ClipmanSelection *self)
+{
+  XEvent event;
+
+  while (XPending (self->display))
+    {
+      XNextEvent (self->display, &event);
+      handle_event (self, &event);
+    }
+}
+
+static gboolean
+on_x_readable (gint fd, GIOCondition condition, gpointer user_data)
+{
+  ClipmanSelection *self = CLIPMAN_SELECTION (user_data);
+
+  dispatch_events (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+ClipmanSelection *
+clipman_selection_new (const gchar *display_name, GError **error)
+{
+  ClipmanSelection *self;
+  Display *display;
+  int error_base;
+  glong max_request;
+
+  display = XOpenDisplay (display_name);
+  if (!display)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   _ ("Cannot open display %s"), XDisplayName (display_name));
+      return NULL;
+    }
+
+  self = g_object_new (CLIPMAN_TYPE_SELECTION, NULL);
+  self->display = display;
+
+  if (!XFixesQueryExtension (display, &self->xfixes_event_base, &error_base))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   _ ("The X server does not support XFixes"));
+      g_object_unref (self);
+      return NULL;
+    }
+
+  XSetErrorHandler (on_x_error);
+  XInternAtoms (display, atom_names, N_ATOMS, False, self->atoms);
+
+  self->selections[CLIPMAN_SOURCE_CLIPBOARD].selection
+      = self->atoms[ATOM_CLIPBOARD];
+  self->selections[CLIPMAN_SOURCE_CLIPBOARD].property
+      = self->atoms[ATOM_CLIPMAN_CLIPBOARD];
+  self->selections[CLIPMAN_SOURCE_PRIMARY].selection = XA_PRIMARY;
+  self->selections[CLIPMAN_SOURCE_PRIMARY].property
+      = self->atoms[ATOM_CLIPMAN_PRIMARY];
+
+  /* Leave room for the request header */
+  max_request = XExtendedMaxRequestSize (display);
+  if (max_request == 0)
+    max_request = XMaxRequestSize (display);
+  self->max_chunk = MIN ((gsize)max_request * 4 - 100, MAX_CHUNK_SIZE);
+
+  self->window = XCreateSimpleWindow (display, DefaultRootWindow (display),
+                                      -10, -10, 1, 1, 0, 0, 0);
+  XSelectInput (display, self->window, PropertyChangeMask);
+
+  self->watch_id = g_unix_fd_add (ConnectionNumber (display), G_IO_IN,
+                                  on_x_readable, self);
+
+  return self;
+}
+
+void
+clipman_selection_set_settings (ClipmanSelection *self, GSettings *settings)
+{
+  g_return_if_fail (CLIPMAN_IS_SELECTION (self));
+  g_return_if_fail (G_IS_SETTINGS (settings));
+
+  g_clear_object (&self->settings);
+  self->settings = g_object_ref (settings);
+}
+
+void
+clipman_selection_start (ClipmanSelection *self)
+{
+  Window root;
+  gulong mask;
+
+  g_return_if_fail (CLIPMAN_IS_SELECTION (self));
+
+  if (self->running)
+    return;
+
+  self->running = TRUE;
+
+  root = DefaultRootWindow (self->display);
+  mask = XFixesSetSelectionOwnerNotifyMask
+         | XFixesSelectionWindowDestroyNotifyMask
+         | XFixesSelectionClientCloseNotifyMask;
+  for (guint i = 0; i < CLIPMAN_N_SOURCES; i++)
+    XFixesSelectSelectionInput (self->display, root,
+                                self->selections[i].selection, mask);
+
+  /* Pick up what was copied before we started */
+  if (XGetSelectionOwner (self->display, self->atoms[ATOM_CLIPBOARD]) != None)
+    convert (&self->selections[CLIPMAN_SOURCE_CLIPBOARD], FETCH_TARGETS,
+             self->atoms[ATOM_TARGETS]);
+
+  XFlush (self->display);
+  dispatch_events (self);
+}
+
+void
+clipman_selection_stop (ClipmanSelection *self)
+{
+  g_return_if_fail (CLIPMAN_IS_SELECTION (self));
+
+  if (!self->running)
+    return;
+
+  self->running = FALSE;
+
+  for (guint i = 0; i < CLIPMAN_N_SOURCES; i++)
+    {
+      XFixesSelectSelectionInput (self->display,
+                                  DefaultRootWindow (self->display),
+                                  self->selections[i].selection, 0);
+      reset_fetch (&self->selections[i]);
+    }
+
+  XFlush (self->display);
+}
+
+void
+clipman_selection_set_item (ClipmanSelection *self, ClipmanItem *item,
+                            ClipmanSource source)
+{
+  Selection *sel;
+
+  g_return_if_fail (CLIPMAN_IS_SELECTION (self));
+  g_return_if_fail (CLIPMAN_IS_ITEM (item));
+  g_return_if_fail (source < CLIPMAN_N_SOURCES);
+
+  sel = &self->selections[source];
+
+  /* Our own item coming back from the owner change isn't a new one */
+  g_free (sel->last_checksum);
+  sel->last_checksum = g_strdup (clipman_item_get_checksum (item));
+
+  g_set_object (&sel->owned, item);
+  sel->owned_time = self->last_time;
+
+  XSetSelectionOwner (self->display, sel->selection, self->window,
+                      sel->owned_time);
+  if (XGetSelectionOwner (self->display, sel->selection) != self->window)
+    {
+      g_warning ("Failed to take ownership of the selection");
+      g_clear_object (&sel->owned);
+    }
+
+  dispatch_events (self);
+}
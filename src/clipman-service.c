@@ -0,0 +1,463 @@
+/*
+ * clipman-service.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ * 
+ * Copyright 2025 Kerem Soke
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#define _GNU_SOURCE /* memfd_create */
+
+#include "clipman.h"
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gunixfdlist.h>
+#include <glib/gstdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ITEM_SIGNATURE CLIPMAN_ITEM_VARIANT_TYPE
+
+static const gchar introspection_xml[]
+    = "<node>"
+      "  <interface name='" CLIPMAN_SERVICE_INTERFACE "'>"
+      "    <method name='List'>"
+      "      <arg type='u' name='offset' direction='in'/>"
+      "      <arg type='u' name='limit' direction='in'/>"
+      "      <arg type='a" ITEM_SIGNATURE "' name='items' direction='out'/>"
+      "    </method>"
+      "    <method name='Search'>"
+      "      <arg type='s' name='query' direction='in'/>"
+      "      <arg type='u' name='offset' direction='in'/>"
+      "      <arg type='u' name='limit' direction='in'/>"
+      "      <arg type='a" ITEM_SIGNATURE "' name='items' direction='out'/>"
+      "    </method>"
+      "    <method name='Get'>"
+      "      <arg type='x' name='id' direction='in'/>"
+      "      <arg type='" ITEM_SIGNATURE "' name='item' direction='out'/>"
+      "      <arg type='s' name='text' direction='out'/>"
+      "    </method>"
+      "    <method name='GetContent'>"
+      "      <arg type='x' name='id' direction='in'/>"
+      "      <arg type='s' name='mime_type' direction='out'/>"
+      "      <arg type='t' name='size' direction='out'/>"
+      "      <arg type='h' name='content' direction='out'/>"
+      "    </method>"
+      "    <method name='Select'>"
+      "      <arg type='x' name='id' direction='in'/>"
+      "    </method>"
+      "    <method name='Delete'>"
+      "      <arg type='x' name='id' direction='in'/>"
+      "    </method>"
+      "    <method name='Clear'/>"
+      "    <method name='GetLatencies'>"
+      "      <arg type='a{sat}' name='histograms' direction='out'/>"
+      "    </method>"
+      "    <signal name='ItemAdded'>"
+      "      <arg type='" ITEM_SIGNATURE "' name='item'/>"
+      "    </signal>"
+      "    <signal name='ItemRemoved'>"
+      "      <arg type='x' name='id'/>"
+      "    </signal>"
+      "    <signal name='Cleared'/>"
+      "    <signal name='Changed'/>"
+      "  </interface>"
+      "</node>";
+
+struct _ClipmanService
+{
+  GObject parent;
+
+  ClipmanStorage *storage;
+  GDBusConnection *connection;
+  guint registration_id;
+};
+
+G_DEFINE_TYPE (ClipmanService, clipman_service, G_TYPE_OBJECT)
+
+enum
+{
+  SIGNAL_ITEM_SELECTED,
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+static GDBusNodeInfo *introspection_data;
+
+static GVariant *
+item_to_variant (ClipmanItem *item)
+{
+  GDateTime *timestamp = clipman_item_get_timestamp (item);
+  const gchar *label = clipman_item_get_label (item);
+
+  return g_variant_new (ITEM_SIGNATURE, clipman_item_get_id (item),
+                        (guint32) clipman_item_get_item_type (item),
+                        (guint32) clipman_item_get_source (item),
+                        label ? label : "",
+                        timestamp ? g_date_time_to_unix (timestamp) : 0);
+}
+
+static const gchar *
+get_mime_type (ClipmanItemType type)
+{
+  switch (type)
+    {
+    case CLIPMAN_ITEM_TYPE_IMAGE:
+      return "image/png";
+    case CLIPMAN_ITEM_TYPE_FILES:
+      return "text/uri-list";
+    default:
+      return "text/plain;charset=utf-8";
+    }
+}
+
+static gint
+content_to_fd (GBytes *bytes, GError **error)
+{
+  const guint8 *data;
+  gsize size;
+  gsize written = 0;
+  gint fd;
+
+  /* A sealed memfd lets the client mmap the payload instead of copying it
+   * through the bus daemon; fall back to an unlinked temporary file */
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create ("clipman-content", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+#endif
+    {
+      gchar *path = NULL;
+
+      fd = g_file_open_tmp ("clipman-content-XXXXXX", &path, error);
+      if (fd < 0)
+        return -1;
+
+      g_unlink (path);
+      g_free (path);
+    }
+
+  data = g_bytes_get_data (bytes, &size);
+  while (written < size)
+    {
+      gssize n = write (fd, data + written, size - written);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n < 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Failed to write content: %s", g_strerror (errno));
+          close (fd);
+          return -1;
+        }
+
+      written += n;
+    }
+
+#ifdef HAVE_MEMFD_CREATE
+  fcntl (fd, F_ADD_SEALS,
+         F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+  lseek (fd, 0, SEEK_SET);
+
+  return fd;
+}
+
+static void
+return_content (ClipmanService *self, GDBusMethodInvocation *invocation,
+                gint64 id)
+{
+  GDBusConnection *connection;
+  ClipmanItemType type;
+  GUnixFDList *fd_list;
+  GBytes *bytes;
+  GError *error = NULL;
+  gint fd;
+
+  connection = g_dbus_method_invocation_get_connection (invocation);
+  if (!(g_dbus_connection_get_capabilities (connection)
+        & G_DBUS_CAPABILITY_FLAGS_UNIX_FD_PASSING))
+    {
+      g_dbus_method_invocation_return_error (
+          invocation, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+          "The connection does not support passing file descriptors");
+      return;
+    }
+
+  bytes = clipman_storage_get_content (self->storage, id, &type);
+  if (!bytes)
+    {
+      g_dbus_method_invocation_return_error (
+          invocation, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+          "No history item with id %" G_GINT64_FORMAT, id);
+      return;
+    }
+
+  fd = content_to_fd (bytes, &error);
+  if (fd < 0)
+    {
+      g_bytes_unref (bytes);
+      g_dbus_method_invocation_take_error (invocation, error);
+      return;
+    }
+
+  /* The list owns the descriptor from here on */
+  fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+  g_dbus_method_invocation_return_value_with_unix_fd_list (
+      invocation,
+      g_variant_new ("(sth)", get_mime_type (type),
+                     (guint64) g_bytes_get_size (bytes), 0),
+      fd_list);
+
+  g_object_unref (fd_list);
+  g_bytes_unref (bytes);
+}
+
+static void
+handle_method_call (GDBusConnection *connection, const gchar *sender,
+                    const gchar *object_path, const gchar *interface_name,
+                    const gchar *method_name, GVariant *parameters,
+                    GDBusMethodInvocation *invocation, gpointer user_data)
+{
+  ClipmanService *self = CLIPMAN_SERVICE (user_data);
+  ClipmanItem *item;
+  const gchar *query = NULL;
+  guint32 offset, limit;
+  gint64 id;
+
+  /* A limit of 0 returns everything from offset on */
+  if (g_strcmp0 (method_name, "List") == 0
+      || g_strcmp0 (method_name, "Search") == 0)
+    {
+      if (g_strcmp0 (method_name, "List") == 0)
+        g_variant_get (parameters, "(uu)", &offset, &limit);
+      else
+        g_variant_get (parameters, "(&suu)", &query, &offset, &limit);
+
+      g_dbus_method_invocation_return_value (
+          invocation,
+          g_variant_new (
+              "(@a" ITEM_SIGNATURE ")",
+              clipman_storage_list (self->storage, query, offset, limit)));
+    }
+  else if (g_strcmp0 (method_name, "GetContent") == 0)
+    {
+      g_variant_get (parameters, "(x)", &id);
+      return_content (self, invocation, id);
+    }
+  else if (g_strcmp0 (method_name, "Get") == 0
+           || g_strcmp0 (method_name, "Select") == 0)
+    {
+      g_variant_get (parameters, "(x)", &id);
+      item = clipman_storage_get_item (self->storage, id);
+      if (!item)
+        {
+          g_dbus_method_invocation_return_error (
+              invocation, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+              "No history item with id %" G_GINT64_FORMAT, id);
+          return;
+        }
+
+      if (g_strcmp0 (method_name, "Get") == 0)
+        {
+          const gchar *text = clipman_item_get_text (item);
+
+          g_dbus_method_invocation_return_value (
+              invocation, g_variant_new ("(@" ITEM_SIGNATURE "s)",
+                                         item_to_variant (item),
+                                         text ? text : ""));
+        }
+      else
+        {
+          g_signal_emit (self, signals[SIGNAL_ITEM_SELECTED], 0, item);
+          g_dbus_method_invocation_return_value (invocation, NULL);
+        }
+
+      g_object_unref (item);
+    }
+  else if (g_strcmp0 (method_name, "Delete") == 0)
+    {
+      g_variant_get (parameters, "(x)", &id);
+      clipman_storage_remove_item (self->storage, id);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (g_strcmp0 (method_name, "Clear") == 0)
+    {
+      clipman_storage_clear (self->storage);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (g_strcmp0 (method_name, "GetLatencies") == 0)
+    {
+      g_dbus_method_invocation_return_value (
+          invocation,
+          g_variant_new ("(@a{sat})", clipman_latency_to_variant ()));
+    }
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+  handle_method_call,
+  NULL,
+  NULL,
+};
+
+static void
+emit_dbus_signal (ClipmanService *self, const gchar *name,
+                  GVariant *parameters)
+{
+  GError *error = NULL;
+
+  if (!self->registration_id)
+    {
+      if (parameters)
+        g_variant_unref (g_variant_ref_sink (parameters));
+      return;
+    }
+
+  if (!g_dbus_connection_emit_signal (self->connection, NULL,
+                                      CLIPMAN_SERVICE_PATH,
+                                      CLIPMAN_SERVICE_INTERFACE, name,
+                                      parameters, &error))
+    {
+      g_warning ("Failed to emit %s: %s", name, error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+on_item_added (ClipmanStorage *storage, ClipmanItem *item,
+               ClipmanService *self)
+{
+  emit_dbus_signal (self, "ItemAdded",
+                    g_variant_new ("(@" ITEM_SIGNATURE ")",
+                                   item_to_variant (item)));
+}
+
+static void
+on_item_removed (ClipmanStorage *storage, gint64 id, ClipmanService *self)
+{
+  emit_dbus_signal (self, "ItemRemoved", g_variant_new ("(x)", id));
+}
+
+static void
+on_cleared (ClipmanStorage *storage, ClipmanService *self)
+{
+  emit_dbus_signal (self, "Cleared", NULL);
+}
+
+static void
+on_changed (ClipmanStorage *storage, ClipmanService *self)
+{
+  emit_dbus_signal (self, "Changed", NULL);
+}
+
+static void
+clipman_service_dispose (GObject *object)
+{
+  ClipmanService *self = CLIPMAN_SERVICE (object);
+
+  clipman_service_unexport (self);
+
+  if (self->storage)
+    {
+      g_signal_handlers_disconnect_by_data (self->storage, self);
+      g_clear_object (&self->storage);
+    }
+
+  G_OBJECT_CLASS (clipman_service_parent_class)->dispose (object);
+}
+
+static void
+clipman_service_class_init (ClipmanServiceClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = clipman_service_dispose;
+
+  /* Emitted when a client asks for an item to be put on the clipboard;
+   * only the process owning the selections can do that */
+  signals[SIGNAL_ITEM_SELECTED] = g_signal_new (
+      "item-selected", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL,
+      NULL, NULL, G_TYPE_NONE, 1, CLIPMAN_TYPE_ITEM);
+
+  introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+  g_assert (introspection_data != NULL);
+}
+
+static void
+clipman_service_init (ClipmanService *self)
+{
+}
+
+ClipmanService *
+clipman_service_new (ClipmanStorage *storage)
+{
+  ClipmanService *self;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (storage), NULL);
+
+  self = g_object_new (CLIPMAN_TYPE_SERVICE, NULL);
+  self->storage = g_object_ref (storage);
+
+  g_signal_connect (storage, "item-added", G_CALLBACK (on_item_added), self);
+  g_signal_connect (storage, "item-removed", G_CALLBACK (on_item_removed),
+                    self);
+  g_signal_connect (storage, "cleared", G_CALLBACK (on_cleared), self);
+  g_signal_connect (storage, "changed", G_CALLBACK (on_changed), self);
+
+  return self;
+}
+
+gboolean
+clipman_service_export (ClipmanService *self, GDBusConnection *connection,
+                        GError **error)
+{
+  g_return_val_if_fail (CLIPMAN_IS_SERVICE (self), FALSE);
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), FALSE);
+  g_return_val_if_fail (self->registration_id == 0, FALSE);
+
+  self->registration_id = g_dbus_connection_register_object (
+      connection, CLIPMAN_SERVICE_PATH, introspection_data->interfaces[0],
+      &interface_vtable, self, NULL, error);
+  if (!self->registration_id)
+    return FALSE;
+
+  self->connection = g_object_ref (connection);
+
+  return TRUE;
+}
+
+void
+clipman_service_unexport (ClipmanService *self)
+{
+  g_return_if_fail (CLIPMAN_IS_SERVICE (self));
+
+  if (self->registration_id)
+    {
+      g_dbus_connection_unregister_object (self->connection,
+                                           self->registration_id);
+      self->registration_id = 0;
+    }
+
+  g_clear_object (&self->connection);
+}
@@ -0,0 +1,270 @@
+/*
+ * clipman-snapshot.c
+ *
+ * MATE Clipboard Manager
+ * A clipboard history manager for the MATE Desktop
+ * 
+ * Copyright 2025 Kerem Soke
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include "clipman.h"
+#include "config.h"
+
+/*
+ * The snapshot is a flat file meant to be mapped, not parsed: a header, a
+ * fixed-size record per item, then NUL-terminated labels and PNG
+ * thumbnails that the records point at by offset.  It is written in host
+ * byte order; a reader on another architecture sees a bad version and
+ * ignores the file.
+ */
+
+#define SNAPSHOT_MAGIC "CLIPSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 n_items;
+} SnapshotHeader;
+
+typedef struct
+{
+  gint64 id;
+  gint64 timestamp;
+  guint32 type;
+  guint32 source;
+  guint32 label_offset;
+  guint32 label_size;
+  guint32 thumbnail_offset;
+  guint32 thumbnail_size;
+} SnapshotRecord;
+
+struct _ClipmanSnapshot
+{
+  GMappedFile *file;
+  const SnapshotRecord *records;
+  guint n_items;
+};
+
+/* Next to the history it is written from, so it stays local when the
+ * data directory is on a network file system */
+gchar *
+clipman_snapshot_get_default_path (void)
+{
+  gchar *dir = clipman_storage_get_default_dir (NULL);
+  gchar *path = g_build_filename (dir, "recent.snap", NULL);
+
+  g_free (dir);
+  return path;
+}
+
+static gboolean
+check_range (gsize offset, gsize size, gsize length)
+{
+  return offset <= length && size <= length - offset;
+}
+
+static gboolean
+validate (const gchar *data, gsize length, guint n_items)
+{
+  const SnapshotRecord *records
+      = (const SnapshotRecord *)(data + sizeof (SnapshotHeader));
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      const SnapshotRecord *record = &records[i];
+
+      /* Labels must be terminated inside the file so they can be used
+       * directly from the mapping */
+      if (!check_range (record->label_offset, (gsize)record->label_size + 1,
+                        length)
+          || data[record->label_offset + record->label_size] != '\0'
+          || !check_range (record->thumbnail_offset, record->thumbnail_size,
+                           length)
+          || record->type >= CLIPMAN_N_ITEM_TYPES
+          || record->source >= CLIPMAN_N_SOURCES)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+ClipmanSnapshot *
+clipman_snapshot_open (const gchar *path, GError **error)
+{
+  ClipmanSnapshot *snapshot;
+  const SnapshotHeader *header;
+  GMappedFile *file;
+  const gchar *data;
+  gsize length;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  file = g_mapped_file_new (path, FALSE, error);
+  if (!file)
+    return NULL;
+
+  data = g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+  header = (const SnapshotHeader *)data;
+
+  if (length < sizeof (SnapshotHeader)
+      || memcmp (header->magic, SNAPSHOT_MAGIC, sizeof (header->magic)) != 0
+      || header->version != SNAPSHOT_VERSION
+      || !check_range (sizeof (SnapshotHeader),
+                       (gsize)header->n_items * sizeof (SnapshotRecord),
+                       length)
+      || !validate (data, length, header->n_items))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s is not a valid history snapshot", path);
+      g_mapped_file_unref (file);
+      return NULL;
+    }
+
+  snapshot = g_new0 (ClipmanSnapshot, 1);
+  snapshot->file = file;
+  snapshot->records
+      = (const SnapshotRecord *)(data + sizeof (SnapshotHeader));
+  snapshot->n_items = header->n_items;
+
+  return snapshot;
+}
+
+void
+clipman_snapshot_free (ClipmanSnapshot *snapshot)
+{
+  if (!snapshot)
+    return;
+
+  g_mapped_file_unref (snapshot->file);
+  g_free (snapshot);
+}
+
+guint
+clipman_snapshot_get_n_items (ClipmanSnapshot *snapshot)
+{
+  g_return_val_if_fail (snapshot != NULL, 0);
+
+  return snapshot->n_items;
+}
+
+void
+clipman_snapshot_get_item (ClipmanSnapshot *snapshot, guint index,
+                           ClipmanSnapshotItem *item)
+{
+  const gchar *data;
+  const SnapshotRecord *record;
+
+  g_return_if_fail (snapshot != NULL);
+  g_return_if_fail (index < snapshot->n_items);
+
+  data = g_mapped_file_get_contents (snapshot->file);
+  record = &snapshot->records[index];
+
+  item->id = record->id;
+  item->timestamp = record->timestamp;
+  item->type = record->type;
+  item->source = record->source;
+  item->label = data + record->label_offset;
+  item->thumbnail = record->thumbnail_size
+                        ? (const guint8 *)data + record->thumbnail_offset
+                        : NULL;
+  item->thumbnail_size = record->thumbnail_size;
+}
+
+gboolean
+clipman_snapshot_find (ClipmanSnapshot *snapshot, gint64 id,
+                       ClipmanSnapshotItem *item)
+{
+  g_return_val_if_fail (snapshot != NULL, FALSE);
+
+  for (guint i = 0; i < snapshot->n_items; i++)
+    {
+      if (snapshot->records[i].id == id)
+        {
+          clipman_snapshot_get_item (snapshot, i, item);
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static guint32
+append_data (GByteArray *buffer, gconstpointer data, gsize size)
+{
+  guint32 offset = buffer->len;
+
+  if (size > 0)
+    g_byte_array_append (buffer, data, size);
+
+  return offset;
+}
+
+gboolean
+clipman_snapshot_write (const gchar *path, const ClipmanSnapshotItem *items,
+                        guint n_items, GError **error)
+{
+  SnapshotHeader header = { { 0 }, SNAPSHOT_VERSION, n_items };
+  SnapshotRecord *records;
+  GByteArray *buffer;
+  gboolean ok;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  buffer = g_byte_array_new ();
+  records = g_new0 (SnapshotRecord, n_items);
+  memcpy (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic));
+
+  g_byte_array_append (buffer, (const guint8 *)&header, sizeof (header));
+  g_byte_array_set_size (buffer,
+                         sizeof (header) + n_items * sizeof (SnapshotRecord));
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      const gchar *label = items[i].label ? items[i].label : "";
+
+      records[i].id = items[i].id;
+      records[i].timestamp = items[i].timestamp;
+      records[i].type = items[i].type;
+      records[i].source = items[i].source;
+      records[i].label_size = strlen (label);
+      records[i].label_offset
+          = append_data (buffer, label, records[i].label_size + 1);
+      records[i].thumbnail_size = items[i].thumbnail_size;
+      records[i].thumbnail_offset = append_data (
+          buffer, items[i].thumbnail, items[i].thumbnail_size);
+    }
+
+  memcpy (buffer->data + sizeof (header), records,
+          n_items * sizeof (SnapshotRecord));
+
+  /* Written to a temporary file and renamed, so readers that still map
+   * the old snapshot are not affected */
+  ok = g_file_set_contents (path, (const gchar *)buffer->data, buffer->len,
+                            error);
+
+  g_byte_array_unref (buffer);
+  g_free (records);
+
+  return ok;
+}
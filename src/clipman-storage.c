@@ -26,6 +26,91 @@
 
 #include "clipman.h"
 #include "config.h"
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+/* Bounds for the auto-tuned page cache and memory map */
+#define CACHE_SIZE_MIN (2 * 1024 * 1024)
+#define CACHE_SIZE_MAX (64 * 1024 * 1024)
+#define MMAP_SIZE_MIN (4 * 1024 * 1024)
+#define MMAP_SIZE_MAX (256 * 1024 * 1024)
+#define TEMP_STORE_MEMORY_MIN (256 * 1024 * 1024)
+#define NEW_DB_PAGE_SIZE 4096
+
+/* Writers wait for each other through a bounded busy handler, then retry
+ * the whole transaction with random jitter */
+#define BUSY_MAX_CALLS 12
+#define BUSY_SLEEP_MAX_MS 16
+#define WRITE_ATTEMPTS 3
+#define WRITE_RETRY_MIN_US 2000
+#define WRITE_RETRY_MAX_US 10000
+
+/* Number of inserts between checks of the database size */
+#define RETUNE_INTERVAL 64
+
+/* Items older than HOT_MAX_AGE seconds, beyond the newest HOT_MIN_ITEMS,
+ * are moved from the hot database to the attached archive */
+#define HOT_MIN_ITEMS 500
+#define HOT_MAX_AGE (7 * 24 * 60 * 60)
+#define ARCHIVE_CACHE_SIZE_KIB 512
+#define MIGRATE_DELAY 30
+#define MIGRATE_BATCH 100
+
+#define ITEM_COLUMNS                                                          \
+  "id, type, source, checksum, label, text_content, image_data, timestamp"
+
+/* Export file format: a header line, then one line per item holding
+ * tab-separated type, source, timestamp, checksum, base64 label and base64
+ * payload (text or PNG data) */
+#define EXPORT_HEADER "mate-clipman-history 1"
+#define EXPORT_FIELDS 6
+#define EXPORT_CHUNK (3 * 4096)
+#define IMPORT_BATCH 2048
+#define IMPORT_BATCH_BYTES (32 * 1024 * 1024)
+
+/* Changes made by other processes are announced through a changelog table.
+ * Only the newest CHANGELOG_KEEP entries are kept, and bursts larger than
+ * CHANGES_EMIT_MAX are announced as a single "changed" signal. */
+#define CHANGELOG_KEEP 10000
+#define CHANGES_EMIT_MAX 500
+#define WAL_MONITOR_RATE_LIMIT 200
+
+typedef enum
+{
+  CHANGE_ITEM_ADDED,
+  CHANGE_ITEM_REMOVED,
+  CHANGE_ITEM_UPDATED
+} ChangeOp;
+
+typedef struct
+{
+  gint64 item_id;
+  ChangeOp op;
+} ChangeEntry;
+
+/* Online backups copy this many pages per main loop iteration */
+#define BACKUP_STEP_PAGES 64
+
+/* statfs() magic numbers of network file systems.  Homes on these keep
+ * the live databases on local disk and get a copy SYNC_DELAY seconds
+ * after the first write that isn't in it yet, made BACKUP_STEP_PAGES
+ * pages at a time.  The archive is only copied when it changed. */
+#define NFS_SUPER_MAGIC 0x6969
+#define SMB_SUPER_MAGIC 0x517b
+#define CIFS_SUPER_MAGIC 0xff534d42
+#define SMB2_SUPER_MAGIC 0xfe534d42
+#define SYNC_DELAY 60
+
+/* Both tiers are backed up, each into its own rotated set of files */
+static const gchar *backup_schemas[] = { "main", "archive" };
+static const gchar *backup_names[] = { "history", "archive" };
+
+/* Payload size of an items row, as used by the stats triggers */
+#define ITEM_BYTES(row)                                                       \
+  "length(CAST(coalesce(" row ".text_content, '') AS BLOB))"                  \
+  " + coalesce(length(" row ".image_data), 0)"
 
 struct _ClipmanStorage
 {
@@ -33,6 +118,44 @@ struct _ClipmanStorage
 
   sqlite3 *db;
   gchar *db_path;
+  gchar *sync_dir;
+  guint sync_interval;
+  guint sync_id;
+  guint sync_schema;
+  gboolean sync_again;
+  gboolean archive_changed;
+  sqlite3 *sync_db;
+  sqlite3_backup *sync_backup;
+
+  gint64 tuned_size;
+  guint writes_since_tune;
+  gboolean untuned;
+
+  gboolean opening;
+  gboolean changed_while_opening;
+
+  gboolean busy;
+  gint64 n_contended;
+  gboolean cache_shrunk;
+
+  guint migrate_id;
+
+  gint32 origin;
+  gint64 data_version;
+  gint64 last_seq;
+  GFileMonitor *wal_monitor;
+  guint changes_idle_id;
+
+  gchar *snapshot_path;
+  guint snapshot_id;
+
+  guint backup_count;
+  guint backup_interval;
+  guint backup_timeout_id;
+  guint backup_idle_id;
+  guint backup_schema;
+  sqlite3 *backup_db;
+  sqlite3_backup *backup;
 };
 
 G_DEFINE_TYPE (ClipmanStorage, clipman_storage, G_TYPE_OBJECT)
@@ -42,29 +165,148 @@ enum
   SIGNAL_ITEM_ADDED,
   SIGNAL_ITEM_REMOVED,
   SIGNAL_CLEARED,
+  SIGNAL_CHANGED,
   N_SIGNALS
 };
 
 static guint signals[N_SIGNALS];
 
+enum
+{
+  PROP_0,
+  PROP_PATH,
+  PROP_SYNC_DIR,
+  PROP_SYNC_INTERVAL,
+  N_PROPS
+};
+
+static GParamSpec *properties[N_PROPS];
+
+static void watch_external_changes (ClipmanStorage *self);
+static void write_snapshot (ClipmanStorage *self);
+static void schedule_backup (ClipmanStorage *self);
+static void schedule_sync (ClipmanStorage *self);
+static void sync_to_home (ClipmanStorage *self);
+
 static void
 clipman_storage_finalize (GObject *object)
 {
   ClipmanStorage *self = CLIPMAN_STORAGE (object);
 
+  if (self->migrate_id > 0)
+    g_source_remove (self->migrate_id);
+  if (self->backup_timeout_id > 0)
+    g_source_remove (self->backup_timeout_id);
+  if (self->backup_idle_id > 0)
+    g_source_remove (self->backup_idle_id);
+  if (self->changes_idle_id > 0)
+    g_source_remove (self->changes_idle_id);
+
+  /* Don't leave a stale snapshot behind */
+  if (self->snapshot_id > 0)
+    {
+      g_source_remove (self->snapshot_id);
+      write_snapshot (self);
+    }
+
+  /* Runs when the session ends, so nothing written stays behind */
+  if (self->sync_id > 0)
+    {
+      g_source_remove (self->sync_id);
+      sync_to_home (self);
+    }
+
+  if (self->wal_monitor)
+    {
+      g_signal_handlers_disconnect_by_data (self->wal_monitor, self);
+      g_file_monitor_cancel (self->wal_monitor);
+      g_object_unref (self->wal_monitor);
+    }
+
+  /* An unfinished backup must be released before its source connection */
+  if (self->backup)
+    sqlite3_backup_finish (self->backup);
+  if (self->backup_db)
+    sqlite3_close (self->backup_db);
+
   if (self->db)
     sqlite3_close (self->db);
   g_free (self->db_path);
+  g_free (self->sync_dir);
+  g_free (self->snapshot_path);
 
   G_OBJECT_CLASS (clipman_storage_parent_class)->finalize (object);
 }
 
+static void
+clipman_storage_get_property (GObject *object, guint prop_id, GValue *value,
+                              GParamSpec *pspec)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (object);
+
+  switch (prop_id)
+    {
+    case PROP_PATH:
+      g_value_set_string (value, self->db_path);
+      break;
+    case PROP_SYNC_DIR:
+      g_value_set_string (value, self->sync_dir);
+      break;
+    case PROP_SYNC_INTERVAL:
+      g_value_set_uint (value, self->sync_interval);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+clipman_storage_set_property (GObject *object, guint prop_id,
+                              const GValue *value, GParamSpec *pspec)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (object);
+
+  switch (prop_id)
+    {
+    case PROP_PATH:
+      g_free (self->db_path);
+      self->db_path = g_value_dup_string (value);
+      break;
+    case PROP_SYNC_DIR:
+      g_free (self->sync_dir);
+      self->sync_dir = g_value_dup_string (value);
+      break;
+    case PROP_SYNC_INTERVAL:
+      self->sync_interval = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
 static void
 clipman_storage_class_init (ClipmanStorageClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
   object_class->finalize = clipman_storage_finalize;
+  object_class->get_property = clipman_storage_get_property;
+  object_class->set_property = clipman_storage_set_property;
+
+  /* NULL picks the user's history; ":memory:" keeps it in this process */
+  properties[PROP_PATH] = g_param_spec_string (
+      "path", "Path", "Database file", NULL,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+  properties[PROP_SYNC_DIR] = g_param_spec_string (
+      "sync-dir", "Sync Directory",
+      "Directory the databases are copied to after changes", NULL,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+  properties[PROP_SYNC_INTERVAL] = g_param_spec_uint (
+      "sync-interval", "Sync Interval",
+      "Seconds between a change and its copy to the sync directory", 1,
+      G_MAXUINT, SYNC_DELAY, G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
 
   signals[SIGNAL_ITEM_ADDED] = g_signal_new (
       "item-added", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL,
@@ -77,185 +319,222 @@ clipman_storage_class_init (ClipmanStorageClass *klass)
   signals[SIGNAL_CLEARED]
       = g_signal_new ("cleared", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
                       0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+
+  /* Emitted when another process changed more items than are worth
+   * announcing one by one */
+  signals[SIGNAL_CHANGED]
+      = g_signal_new ("changed", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+                      0, NULL, NULL, NULL, G_TYPE_NONE, 0);
 }
 
-static gboolean
-init_database (ClipmanStorage *self)
+static gint64
+query_int64 (ClipmanStorage *self, const gchar *sql)
 {
-  const gchar *sql
-      = "CREATE TABLE IF NOT EXISTS items ("
-        "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "  type INTEGER NOT NULL,"
-        "  source INTEGER NOT NULL,"
-        "  checksum TEXT UNIQUE NOT NULL,"
-        "  label TEXT NOT NULL,"
-        "  text_content TEXT,"
-        "  image_data BLOB,"
-        "  timestamp INTEGER NOT NULL"
-        ");"
-        "CREATE INDEX IF NOT EXISTS idx_timestamp ON items(timestamp DESC);"
-        "CREATE INDEX IF NOT EXISTS idx_checksum ON items(checksum);";
+  sqlite3_stmt *stmt;
+  gint64 value = 0;
 
-  char *err = NULL;
-  if (sqlite3_exec (self->db, sql, NULL, NULL, &err) != SQLITE_OK)
+  if (sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    return 0;
+
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    value = sqlite3_column_int64 (stmt, 0);
+
+  sqlite3_finalize (stmt);
+
+  return value;
+}
+
+static gint64
+get_database_size (ClipmanStorage *self)
+{
+  return query_int64 (self, "PRAGMA page_count")
+         * query_int64 (self, "PRAGMA page_size");
+}
+
+static gint64
+get_available_memory (void)
+{
+  gchar *contents = NULL;
+  gint64 available = -1;
+
+  /* MemAvailable accounts for reclaimable page cache, unlike free pages */
+  if (g_file_get_contents ("/proc/meminfo", &contents, NULL, NULL))
     {
-      g_warning ("Failed to create database tables: %s", err);
-      sqlite3_free (err);
-      return FALSE;
+      const gchar *line = strstr (contents, "MemAvailable:");
+      if (line)
+        available
+            = g_ascii_strtoll (line + strlen ("MemAvailable:"), NULL, 10)
+              * 1024;
+      g_free (contents);
     }
 
-  return TRUE;
+  if (available < 0)
+    {
+      long pages = sysconf (_SC_AVPHYS_PAGES);
+      long page_size = sysconf (_SC_PAGESIZE);
+
+      if (pages > 0 && page_size > 0)
+        available = (gint64)pages * page_size;
+    }
+
+  return available;
 }
 
 static void
-clipman_storage_init (ClipmanStorage *self)
+tune_database (ClipmanStorage *self)
 {
-  gchar *data_dir;
-  int rc;
+  gint64 db_size;
+  gint64 available;
+  gint64 cache_size;
+  gint64 mmap_size;
+  gchar *sql;
+
+  /* Opening and importing retune too, which must not undo
+   * clipman_storage_set_autotune() */
+  if (self->untuned)
+    return;
+
+  db_size = get_database_size (self);
+  available = get_available_memory ();
+  if (available <= 0)
+    available = TEMP_STORE_MEMORY_MIN;
+
+  /* Cache a quarter of the database, but never more than a small share of
+   * the memory that is actually available */
+  cache_size = CLAMP (db_size / 4, CACHE_SIZE_MIN, CACHE_SIZE_MAX);
+  cache_size = MIN (cache_size, MAX (available / 64, CACHE_SIZE_MIN));
+
+  /* Map the whole file with room to grow, rounded to whole megabytes so
+   * small size changes don't remap */
+  mmap_size = CLAMP (db_size * 2, MMAP_SIZE_MIN, MMAP_SIZE_MAX);
+  mmap_size = MIN (mmap_size, available / 16);
+  mmap_size &= ~((gint64)1024 * 1024 - 1);
+
+  sql = g_strdup_printf ("PRAGMA cache_size=-%" G_GINT64_FORMAT ";"
+                         "PRAGMA mmap_size=%" G_GINT64_FORMAT ";"
+                         "PRAGMA temp_store=%s;",
+                         cache_size / 1024, mmap_size,
+                         available >= TEMP_STORE_MEMORY_MIN ? "MEMORY"
+                                                            : "DEFAULT");
+  sqlite3_exec (self->db, sql, NULL, NULL, NULL);
+  g_free (sql);
+
+  g_debug ("Tuned database of %" G_GINT64_FORMAT " bytes: cache %"
+           G_GINT64_FORMAT " KiB, mmap %" G_GINT64_FORMAT " bytes",
+           db_size, cache_size / 1024, mmap_size);
+
+  self->tuned_size = db_size;
+  self->writes_since_tune = 0;
+}
 
-  /* Create data directory */
-  data_dir = g_build_filename (g_get_user_data_dir (), "mate-clipman", NULL);
-  g_mkdir_with_parents (data_dir, 0755);
+static void
+maybe_retune_database (ClipmanStorage *self)
+{
+  gint64 db_size;
 
-  /* Open database */
-  self->db_path = g_build_filename (data_dir, "history.db", NULL);
-  g_free (data_dir);
+  if (self->untuned)
+    return;
 
-  rc = sqlite3_open (self->db_path, &self->db);
-  if (rc != SQLITE_OK)
+  /* Recover from clipman_storage_shrink_cache() on the next write, when
+   * the available memory is looked at again */
+  if (self->cache_shrunk)
     {
-      g_warning ("Cannot open database: %s", sqlite3_errmsg (self->db));
+      self->cache_shrunk = FALSE;
+      tune_database (self);
       return;
     }
 
-  /* Enable WAL mode for better performance */
-  sqlite3_exec (self->db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
-  sqlite3_exec (self->db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+  if (++self->writes_since_tune < RETUNE_INTERVAL)
+    return;
 
-  init_database (self);
+  self->writes_since_tune = 0;
+
+  /* Only retune when the database grew or shrank noticeably */
+  db_size = get_database_size (self);
+  if (db_size > self->tuned_size * 3 / 2 || db_size < self->tuned_size / 2)
+    tune_database (self);
 }
 
-ClipmanStorage *
-clipman_storage_new (void)
+static int
+on_busy (void *user_data, int n_calls)
 {
-  return g_object_new (CLIPMAN_TYPE_STORAGE, NULL);
+  ClipmanStorage *self = user_data;
+
+  /* Back off exponentially, giving up after roughly 150 ms so a stuck
+   * writer elsewhere can't freeze the UI */
+  self->busy = TRUE;
+  if (n_calls >= BUSY_MAX_CALLS)
+    return 0;
+
+  g_usleep (MIN (1 << n_calls, BUSY_SLEEP_MAX_MS) * 1000);
+
+  return 1;
 }
 
-gboolean
-clipman_storage_add_item (ClipmanStorage *self, ClipmanItem *item)
+static gboolean
+begin_write (ClipmanStorage *self)
 {
-  sqlite3_stmt *stmt;
-  const gchar *sql;
-  ClipmanItemType type;
-  gint64 id;
+  gboolean contended = FALSE;
   int rc;
 
-  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
-  g_return_val_if_fail (CLIPMAN_IS_ITEM (item), FALSE);
-
-  type = clipman_item_get_item_type (item);
-
-  /* First, check if item already exists */
-  sql = "SELECT id FROM items WHERE checksum = ?";
-  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
-  if (rc == SQLITE_OK)
+  /* IMMEDIATE takes the write lock up front, so a transaction never fails
+   * halfway through on a lock upgrade */
+  for (guint attempt = 1;; attempt++)
     {
-      sqlite3_bind_text (stmt, 1, clipman_item_get_checksum (item), -1,
-                         SQLITE_STATIC);
-      if (sqlite3_step (stmt) == SQLITE_ROW)
-        {
-          /* Item exists - update timestamp to move it to top */
-          id = sqlite3_column_int64 (stmt, 0);
-          sqlite3_finalize (stmt);
+      self->busy = FALSE;
+      rc = sqlite3_exec (self->db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+      contended |= self->busy;
 
-          sql = "UPDATE items SET timestamp = ? WHERE id = ?";
-          rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
-          if (rc == SQLITE_OK)
-            {
-              sqlite3_bind_int64 (stmt, 1, g_get_real_time () / 1000000);
-              sqlite3_bind_int64 (stmt, 2, id);
-              sqlite3_step (stmt);
-              sqlite3_finalize (stmt);
-            }
-          clipman_item_set_id (item, id);
-          return TRUE;
-        }
-      sqlite3_finalize (stmt);
+      if (rc != SQLITE_BUSY || attempt >= WRITE_ATTEMPTS)
+        break;
+
+      /* Jitter keeps competing writers from retrying in lockstep */
+      g_usleep (g_random_int_range (WRITE_RETRY_MIN_US, WRITE_RETRY_MAX_US)
+                * attempt);
     }
 
-  /* Insert new item */
-  sql = "INSERT INTO items (type, source, checksum, label, text_content, "
-        "image_data, timestamp) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?)";
+  if (contended)
+    self->n_contended++;
 
-  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
   if (rc != SQLITE_OK)
     {
-      g_warning ("Failed to prepare insert statement: %s",
+      g_warning ("Failed to start write transaction: %s",
                  sqlite3_errmsg (self->db));
       return FALSE;
     }
 
-  sqlite3_bind_int (stmt, 1, type);
-  sqlite3_bind_int (stmt, 2, clipman_item_get_source (item));
-  sqlite3_bind_text (stmt, 3, clipman_item_get_checksum (item), -1,
-                     SQLITE_STATIC);
-  sqlite3_bind_text (stmt, 4, clipman_item_get_label (item), -1,
-                     SQLITE_STATIC);
+  return TRUE;
+}
 
-  if (type == CLIPMAN_ITEM_TYPE_TEXT || type == CLIPMAN_ITEM_TYPE_FILES)
-    {
-      sqlite3_bind_text (stmt, 5, clipman_item_get_text (item), -1,
-                         SQLITE_STATIC);
-      sqlite3_bind_null (stmt, 6);
-    }
-  else if (type == CLIPMAN_ITEM_TYPE_IMAGE)
+static gboolean
+end_write (ClipmanStorage *self, gboolean commit)
+{
+  if (commit
+      && sqlite3_exec (self->db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK)
     {
-      gchar *buffer = NULL;
-      gsize size = 0;
-      GdkPixbuf *pixbuf = clipman_item_get_pixbuf (item);
-
-      sqlite3_bind_null (stmt, 5);
-
-      if (gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &size, "png", NULL,
-                                     NULL))
-        {
-          sqlite3_bind_blob (stmt, 6, buffer, size, g_free);
-        }
-      else
+      /* Opening may run in a worker thread, which must not add sources */
+      if (self->opening)
         {
-          sqlite3_bind_null (stmt, 6);
+          self->changed_while_opening = TRUE;
+          return TRUE;
         }
-    }
-
-  sqlite3_bind_int64 (stmt, 7, g_get_real_time () / 1000000);
-
-  rc = sqlite3_step (stmt);
-  sqlite3_finalize (stmt);
 
-  if (rc != SQLITE_DONE)
-    {
-      g_warning ("Failed to insert item: %s", sqlite3_errmsg (self->db));
-      return FALSE;
+      schedule_backup (self);
+      schedule_sync (self);
+      return TRUE;
     }
 
-  id = sqlite3_last_insert_rowid (self->db);
-  clipman_item_set_id (item, id);
-
-  g_signal_emit (self, signals[SIGNAL_ITEM_ADDED], 0, item);
+  sqlite3_exec (self->db, "ROLLBACK", NULL, NULL, NULL);
 
-  return TRUE;
+  return FALSE;
 }
 
-gboolean
-clipman_storage_remove_item (ClipmanStorage *self, gint64 id)
+static gboolean
+exec_with_id (ClipmanStorage *self, const gchar *sql, gint64 id)
 {
   sqlite3_stmt *stmt;
-  const gchar *sql = "DELETE FROM items WHERE id = ?";
   int rc;
 
-  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
-
   rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
   if (rc != SQLITE_OK)
     return FALSE;
@@ -264,187 +543,2517 @@ clipman_storage_remove_item (ClipmanStorage *self, gint64 id)
   rc = sqlite3_step (stmt);
   sqlite3_finalize (stmt);
 
-  if (rc == SQLITE_DONE)
-    {
-      g_signal_emit (self, signals[SIGNAL_ITEM_REMOVED], 0, id);
-      return TRUE;
-    }
+  return rc == SQLITE_DONE;
+}
 
-  return FALSE;
+static gboolean
+has_table (ClipmanStorage *self, const gchar *schema, const gchar *table)
+{
+  gchar *sql;
+  gint64 count;
+
+  sql = g_strdup_printf ("SELECT count(*) FROM %s.sqlite_master "
+                         "WHERE type = 'table' AND name = '%s'",
+                         schema, table);
+  count = query_int64 (self, sql);
+  g_free (sql);
+
+  return count > 0;
 }
 
-static ClipmanItem *
-item_from_row (sqlite3_stmt *stmt)
+static gboolean
+init_database (ClipmanStorage *self, const gchar *schema)
 {
-  ClipmanItem *item = NULL;
-  ClipmanItemType type;
-  ClipmanSource source;
-  const gchar *text;
-  const void *blob;
-  int blob_size;
+  gchar *sql;
+  char *err = NULL;
+  gboolean has_stats;
+  gboolean ret = TRUE;
 
-  type = sqlite3_column_int (stmt, 1);
-  source = sqlite3_column_int (stmt, 2);
+  /* Create the schema and backfill statistics atomically so concurrent
+   * writers can't slip rows in between */
+  if (!begin_write (self))
+    return FALSE;
 
-  switch (type)
+  has_stats = has_table (self, schema, "stats");
+
+  sql = g_strdup_printf (
+      "CREATE TABLE IF NOT EXISTS %s.items ("
+      "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "  type INTEGER NOT NULL,"
+      "  source INTEGER NOT NULL,"
+      "  checksum TEXT UNIQUE NOT NULL,"
+      "  label TEXT NOT NULL,"
+      "  text_content TEXT,"
+      "  image_data BLOB,"
+      "  timestamp INTEGER NOT NULL"
+      ");"
+      "CREATE INDEX IF NOT EXISTS %s.idx_timestamp ON items(timestamp DESC);"
+      "CREATE INDEX IF NOT EXISTS %s.idx_checksum ON items(checksum);"
+      "CREATE TABLE IF NOT EXISTS %s.stats ("
+      "  type INTEGER NOT NULL,"
+      "  source INTEGER NOT NULL,"
+      "  count INTEGER NOT NULL DEFAULT 0,"
+      "  bytes INTEGER NOT NULL DEFAULT 0,"
+      "  PRIMARY KEY (type, source)"
+      ");"
+      "CREATE TRIGGER IF NOT EXISTS %s.stats_insert AFTER INSERT ON items "
+      "BEGIN"
+      "  INSERT OR IGNORE INTO stats (type, source)"
+      "    VALUES (new.type, new.source);"
+      "  UPDATE stats SET count = count + 1,"
+      "    bytes = bytes + " ITEM_BYTES ("new")
+      "    WHERE type = new.type AND source = new.source;"
+      "END;"
+      "CREATE TRIGGER IF NOT EXISTS %s.stats_delete AFTER DELETE ON items "
+      "BEGIN"
+      "  UPDATE stats SET count = count - 1,"
+      "    bytes = bytes - " ITEM_BYTES ("old")
+      "    WHERE type = old.type AND source = old.source;"
+      "END;",
+      schema, schema, schema, schema, schema, schema);
+
+  if (sqlite3_exec (self->db, sql, NULL, NULL, &err) != SQLITE_OK)
     {
-    case CLIPMAN_ITEM_TYPE_TEXT:
-    case CLIPMAN_ITEM_TYPE_FILES:
-      text = (const gchar *)sqlite3_column_text (stmt, 5);
-      if (text)
-        {
-          if (type == CLIPMAN_ITEM_TYPE_TEXT)
-            {
-              item = clipman_item_new_text (text, source);
-            }
-          else
-            {
-              gchar **uris = g_strsplit (text, "\n", -1);
-              item = clipman_item_new_files (uris, source);
-              g_strfreev (uris);
-            }
-        }
-      break;
+      g_warning ("Failed to create %s database tables: %s", schema, err);
+      sqlite3_free (err);
+      ret = FALSE;
+    }
+  g_free (sql);
 
-    case CLIPMAN_ITEM_TYPE_IMAGE:
-      blob = sqlite3_column_blob (stmt, 6);
-      blob_size = sqlite3_column_bytes (stmt, 6);
-      if (blob && blob_size > 0)
+  /* Databases created before the stats table existed need one full scan */
+  if (ret && !has_stats)
+    {
+      sql = g_strdup_printf (
+          "INSERT INTO %s.stats (type, source, count, bytes) "
+          "SELECT type, source, count(*), sum(" ITEM_BYTES ("items") ") "
+          "FROM %s.items GROUP BY type, source",
+          schema, schema);
+      if (sqlite3_exec (self->db, sql, NULL, NULL, &err) != SQLITE_OK)
         {
-          GInputStream *stream = g_memory_input_stream_new_from_data (
-              g_memdup2 (blob, blob_size), blob_size, g_free);
-          GdkPixbuf *pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
-          g_object_unref (stream);
-          if (pixbuf)
-            {
-              item = clipman_item_new_image (pixbuf, source);
-              g_object_unref (pixbuf);
-            }
+          g_warning ("Failed to compute %s statistics: %s", schema, err);
+          sqlite3_free (err);
+          ret = FALSE;
         }
-      break;
+      g_free (sql);
     }
 
-  if (item)
+  return end_write (self, ret);
+}
+
+static gboolean
+init_changelog (ClipmanStorage *self)
+{
+  gchar *sql;
+  char *err = NULL;
+  gboolean ret = TRUE;
+
+  /* The triggers are TEMP so each connection tags its own changes, which
+   * lets it skip them when looking for changes made elsewhere.  Moving an
+   * item between tiers leaves a row in the other tier while it runs, and
+   * is not a change anyone else needs to hear about. */
+  self->origin = g_random_int_range (1, G_MAXINT32);
+
+  sql = g_strdup_printf (
+      "CREATE TABLE IF NOT EXISTS main.changelog ("
+      "  seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "  item_id INTEGER NOT NULL,"
+      "  op INTEGER NOT NULL,"
+      "  origin INTEGER NOT NULL"
+      ");"
+      "CREATE TEMP TRIGGER IF NOT EXISTS changelog_insert "
+      "AFTER INSERT ON main.items WHEN NOT EXISTS "
+      "(SELECT 1 FROM archive.items WHERE id = new.id) BEGIN"
+      "  INSERT INTO changelog (item_id, op, origin)"
+      "    VALUES (new.id, %d, %d);"
+      "END;"
+      "CREATE TEMP TRIGGER IF NOT EXISTS changelog_update "
+      "AFTER UPDATE OF timestamp ON main.items BEGIN"
+      "  INSERT INTO changelog (item_id, op, origin)"
+      "    VALUES (new.id, %d, %d);"
+      "END;"
+      "CREATE TEMP TRIGGER IF NOT EXISTS changelog_delete "
+      "AFTER DELETE ON main.items WHEN NOT EXISTS "
+      "(SELECT 1 FROM archive.items WHERE id = old.id) BEGIN"
+      "  INSERT INTO changelog (item_id, op, origin)"
+      "    VALUES (old.id, %d, %d);"
+      "END;"
+      "CREATE TEMP TRIGGER IF NOT EXISTS changelog_archive_delete "
+      "AFTER DELETE ON archive.items WHEN NOT EXISTS "
+      "(SELECT 1 FROM main.items WHERE id = old.id) BEGIN"
+      "  INSERT INTO changelog (item_id, op, origin)"
+      "    VALUES (old.id, %d, %d);"
+      "END;",
+      CHANGE_ITEM_ADDED, self->origin, CHANGE_ITEM_UPDATED, self->origin,
+      CHANGE_ITEM_REMOVED, self->origin, CHANGE_ITEM_REMOVED, self->origin);
+
+  if (sqlite3_exec (self->db, sql, NULL, NULL, &err) != SQLITE_OK)
     {
-      clipman_item_set_id (item, sqlite3_column_int64 (stmt, 0));
+      g_warning ("Failed to create changelog: %s", err);
+      sqlite3_free (err);
+      ret = FALSE;
     }
+  g_free (sql);
 
-  return item;
+  self->last_seq = query_int64 (self, "SELECT max(seq) FROM main.changelog");
+  self->data_version = query_int64 (self, "PRAGMA data_version");
+
+  return ret;
 }
 
-GList *
-clipman_storage_get_items (ClipmanStorage *self, gint limit)
+static gboolean
+attach_archive (ClipmanStorage *self, const gchar *path)
 {
   sqlite3_stmt *stmt;
-  const gchar *sql = "SELECT id, type, source, checksum, label, text_content, "
-                     "image_data, timestamp "
-                     "FROM items ORDER BY timestamp DESC LIMIT ?";
-  GList *items = NULL;
   int rc;
 
-  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
-
-  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+  rc = sqlite3_prepare_v2 (self->db, "ATTACH DATABASE ? AS archive", -1,
+                           &stmt, NULL);
   if (rc != SQLITE_OK)
-    return NULL;
+    return FALSE;
 
-  sqlite3_bind_int (stmt, 1, limit > 0 ? limit : 100);
+  sqlite3_bind_text (stmt, 1, path, -1, SQLITE_STATIC);
+  rc = sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
 
-  while (sqlite3_step (stmt) == SQLITE_ROW)
+  if (rc != SQLITE_DONE)
     {
-      ClipmanItem *item = item_from_row (stmt);
-      if (item)
-        items = g_list_append (items, item);
+      g_warning ("Cannot attach archive database %s: %s", path,
+                 sqlite3_errmsg (self->db));
+      return FALSE;
     }
 
-  sqlite3_finalize (stmt);
-
-  return items;
+  return TRUE;
 }
 
-ClipmanItem *
-clipman_storage_get_by_checksum (ClipmanStorage *self, const gchar *checksum)
+static gint64
+get_migration_cutoff (ClipmanStorage *self)
 {
   sqlite3_stmt *stmt;
-  const gchar *sql = "SELECT id, type, source, checksum, label, text_content, "
-                     "image_data, timestamp "
-                     "FROM items WHERE checksum = ?";
-  ClipmanItem *item = NULL;
-  int rc;
+  gint64 cutoff = 0;
 
-  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
-  g_return_val_if_fail (checksum != NULL, NULL);
+  /* Nothing migrates until the hot tier holds more than HOT_MIN_ITEMS */
+  if (sqlite3_prepare_v2 (self->db,
+                          "SELECT timestamp FROM main.items "
+                          "ORDER BY timestamp DESC LIMIT 1 OFFSET ?",
+                          -1, &stmt, NULL)
+      != SQLITE_OK)
+    return 0;
 
-  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
-  if (rc != SQLITE_OK)
+  sqlite3_bind_int (stmt, 1, HOT_MIN_ITEMS);
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    cutoff = MIN (sqlite3_column_int64 (stmt, 0) + 1,
+                  g_get_real_time () / 1000000 - HOT_MAX_AGE);
+  sqlite3_finalize (stmt);
+
+  return cutoff;
+}
+
+static gboolean
+migrate_batch (ClipmanStorage *self, gint64 cutoff)
+{
+  sqlite3_stmt *stmt;
+  int changes = 0;
+  int rc;
+
+  if (!begin_write (self))
+    return FALSE;
+
+  rc = sqlite3_prepare_v2 (
+      self->db,
+      "INSERT OR REPLACE INTO archive.items (" ITEM_COLUMNS ") "
+      "SELECT " ITEM_COLUMNS " FROM main.items WHERE timestamp < ? "
+      "ORDER BY timestamp LIMIT ?",
+      -1, &stmt, NULL);
+  if (rc == SQLITE_OK)
+    {
+      sqlite3_bind_int64 (stmt, 1, cutoff);
+      sqlite3_bind_int (stmt, 2, MIGRATE_BATCH);
+      rc = sqlite3_step (stmt);
+      sqlite3_finalize (stmt);
+    }
+
+  /* Only drop hot rows that made it into the archive */
+  if (rc == SQLITE_DONE)
+    {
+      rc = sqlite3_prepare_v2 (
+          self->db,
+          "DELETE FROM main.items WHERE timestamp < ? AND EXISTS "
+          "(SELECT 1 FROM archive.items a WHERE a.id = items.id)",
+          -1, &stmt, NULL);
+      if (rc == SQLITE_OK)
+        {
+          sqlite3_bind_int64 (stmt, 1, cutoff);
+          rc = sqlite3_step (stmt);
+          changes = sqlite3_changes (self->db);
+          sqlite3_finalize (stmt);
+        }
+    }
+
+  if (rc != SQLITE_DONE)
+    {
+      g_warning ("Failed to migrate items to archive: %s",
+                 sqlite3_errmsg (self->db));
+      end_write (self, FALSE);
+      return FALSE;
+    }
+
+  if (!end_write (self, TRUE))
+    return FALSE;
+
+  if (changes > 0)
+    self->archive_changed = TRUE;
+  g_debug ("Migrated %d items to archive", changes);
+
+  return changes >= MIGRATE_BATCH;
+}
+
+static gboolean
+on_migrate_idle (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+  gint64 cutoff;
+
+  /* One batch per main loop iteration keeps ingest responsive */
+  cutoff = get_migration_cutoff (self);
+  if (cutoff > 0 && migrate_batch (self, cutoff))
+    return G_SOURCE_CONTINUE;
+
+  sqlite3_exec (self->db,
+                "DELETE FROM main.changelog WHERE seq <= "
+                "(SELECT max(seq) FROM main.changelog) - "
+                G_STRINGIFY (CHANGELOG_KEEP),
+                NULL, NULL, NULL);
+
+  self->migrate_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_migrate_timeout (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+
+  self->migrate_id
+      = g_idle_add_full (G_PRIORITY_LOW, on_migrate_idle, self, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_migration (ClipmanStorage *self)
+{
+  if (self->migrate_id > 0)
+    return;
+
+  self->migrate_id
+      = g_timeout_add_seconds (MIGRATE_DELAY, on_migrate_timeout, self);
+}
+
+static void
+restore_from_archive (ClipmanStorage *self, gint64 id)
+{
+  if (exec_with_id (self,
+                    "INSERT OR REPLACE INTO main.items (" ITEM_COLUMNS ") "
+                    "SELECT " ITEM_COLUMNS " FROM archive.items WHERE id = ?",
+                    id)
+      && exec_with_id (self, "DELETE FROM archive.items WHERE id = ?", id))
+    self->archive_changed = TRUE;
+}
+
+static GBytes *
+make_thumbnail (ClipmanStorage *self, gint64 id)
+{
+  GInputStream *stream;
+  GdkPixbuf *pixbuf;
+  GBytes *bytes;
+  gchar *png;
+  gsize png_size;
+  gint width, height;
+
+  bytes = clipman_storage_get_content (self, id, NULL);
+  if (!bytes)
+    return NULL;
+
+  stream = g_memory_input_stream_new_from_bytes (bytes);
+  pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
+  g_object_unref (stream);
+  g_bytes_unref (bytes);
+
+  if (!pixbuf)
+    return NULL;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+  if (width > CLIPMAN_THUMBNAIL_SIZE || height > CLIPMAN_THUMBNAIL_SIZE)
+    {
+      gdouble scale = MIN ((gdouble)CLIPMAN_THUMBNAIL_SIZE / width,
+                           (gdouble)CLIPMAN_THUMBNAIL_SIZE / height);
+      GdkPixbuf *scaled = gdk_pixbuf_scale_simple (
+          pixbuf, MAX ((gint)(width * scale), 1),
+          MAX ((gint)(height * scale), 1), GDK_INTERP_BILINEAR);
+
+      g_object_unref (pixbuf);
+      pixbuf = scaled;
+    }
+
+  bytes = NULL;
+  if (gdk_pixbuf_save_to_buffer (pixbuf, &png, &png_size, "png", NULL, NULL))
+    bytes = g_bytes_new_take (png, png_size);
+  g_object_unref (pixbuf);
+
+  return bytes;
+}
+
+static void
+write_snapshot (ClipmanStorage *self)
+{
+  ClipmanSnapshot *old;
+  sqlite3_stmt *stmt;
+  GArray *items;
+  GPtrArray *data;
+  GError *error = NULL;
+
+  if (!self->db || !self->snapshot_path)
+    return;
+
+  if (sqlite3_prepare_v2 (self->db,
+                          "SELECT id, type, source, label, timestamp "
+                          "FROM main.items ORDER BY timestamp DESC LIMIT ?",
+                          -1, &stmt, NULL)
+      != SQLITE_OK)
+    return;
+
+  /* Thumbnails are copied over from the previous snapshot, so each image
+   * is only decoded once */
+  old = clipman_snapshot_open (self->snapshot_path, NULL);
+  items = g_array_new (FALSE, TRUE, sizeof (ClipmanSnapshotItem));
+  data = g_ptr_array_new_with_free_func (g_free);
+
+  sqlite3_bind_int (stmt, 1, CLIPMAN_SNAPSHOT_ITEMS);
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      ClipmanSnapshotItem item = { 0 };
+      ClipmanSnapshotItem previous;
+      gchar *label;
+
+      item.id = sqlite3_column_int64 (stmt, 0);
+      item.type = sqlite3_column_int (stmt, 1);
+      item.source = sqlite3_column_int (stmt, 2);
+      item.timestamp = sqlite3_column_int64 (stmt, 4);
+
+      label = g_strdup ((const gchar *)sqlite3_column_text (stmt, 3));
+      g_ptr_array_add (data, label);
+      item.label = label;
+
+      if (item.type == CLIPMAN_ITEM_TYPE_IMAGE)
+        {
+          if (old && clipman_snapshot_find (old, item.id, &previous)
+              && previous.thumbnail)
+            {
+              item.thumbnail = g_memdup2 (previous.thumbnail,
+                                          previous.thumbnail_size);
+              item.thumbnail_size = previous.thumbnail_size;
+            }
+          else
+            {
+              GBytes *thumbnail = make_thumbnail (self, item.id);
+
+              if (thumbnail)
+                item.thumbnail = g_bytes_unref_to_data (
+                    thumbnail, &item.thumbnail_size);
+            }
+
+          if (item.thumbnail)
+            g_ptr_array_add (data, (gpointer)item.thumbnail);
+        }
+
+      g_array_append_val (items, item);
+    }
+
+  sqlite3_finalize (stmt);
+  clipman_snapshot_free (old);
+
+  if (!clipman_snapshot_write (self->snapshot_path,
+                               (ClipmanSnapshotItem *)items->data, items->len,
+                               &error))
+    {
+      g_warning ("Failed to write history snapshot: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_array_free (items, TRUE);
+  g_ptr_array_unref (data);
+}
+
+static gboolean
+on_snapshot_idle (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+
+  self->snapshot_id = 0;
+  write_snapshot (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_snapshot (ClipmanStorage *self)
+{
+  /* A burst of changes rewrites the snapshot only once */
+  if (self->snapshot_id == 0 && self->snapshot_path)
+    self->snapshot_id
+        = g_idle_add_full (G_PRIORITY_LOW, on_snapshot_idle, self, NULL);
+}
+
+static void
+clipman_storage_init (ClipmanStorage *self)
+{
+}
+
+static gboolean
+is_network_fs (const gchar *path)
+{
+  struct statfs buf;
+
+  if (statfs (path, &buf) != 0)
+    return FALSE;
+
+  switch ((guint32)buf.f_type)
+    {
+    case NFS_SUPER_MAGIC:
+    case SMB_SUPER_MAGIC:
+    case CIFS_SUPER_MAGIC:
+    case SMB2_SUPER_MAGIC:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+/* The directory the default history is worked on in.  WAL is unsafe on
+ * network file systems and every commit would wait for the server, so a
+ * data directory there is replaced by a local one and returned in
+ * SYNC_DIR, to be written back to from time to time. */
+gchar *
+clipman_storage_get_default_dir (gchar **sync_dir)
+{
+  gchar *data_dir;
+  gchar *local_dir;
+
+  if (sync_dir)
+    *sync_dir = NULL;
+
+  data_dir = g_build_filename (g_get_user_data_dir (), "mate-clipman", NULL);
+  g_mkdir_with_parents (data_dir, 0755);
+  if (!is_network_fs (data_dir))
+    return data_dir;
+
+  local_dir
+      = g_build_filename (g_get_user_runtime_dir (), "mate-clipman", NULL);
+  g_mkdir_with_parents (local_dir, 0700);
+  if (is_network_fs (local_dir))
+    {
+      g_free (local_dir);
+      return data_dir;
+    }
+
+  if (sync_dir)
+    *sync_dir = data_dir;
+  else
+    g_free (data_dir);
+
+  return local_dir;
+}
+
+static gint64
+get_mtime (const gchar *path)
+{
+  GStatBuf buf;
+
+  if (g_stat (path, &buf) != 0)
+    return -1;
+
+  return buf.st_mtime;
+}
+
+static void
+remove_wal_files (const gchar *path)
+{
+  gchar *wal = g_strconcat (path, "-wal", NULL);
+  gchar *shm = g_strconcat (path, "-shm", NULL);
+
+  g_unlink (wal);
+  g_unlink (shm);
+
+  g_free (wal);
+  g_free (shm);
+}
+
+/* Starts a copy of schema into a temporary file next to path, to be
+ * stepped through and then handed to copy_finish() */
+static sqlite3_backup *
+copy_begin (sqlite3 *source, const gchar *schema, const gchar *path,
+            sqlite3 **db)
+{
+  sqlite3_backup *backup = NULL;
+  gchar *tmp_path;
+
+  tmp_path = g_strconcat (path, ".sync", NULL);
+  g_unlink (tmp_path);
+
+  if (sqlite3_open (tmp_path, db) == SQLITE_OK)
+    backup = sqlite3_backup_init (*db, "main", source, schema);
+
+  if (!backup)
+    {
+      g_warning ("Cannot copy the history to %s: %s", path,
+                 sqlite3_errmsg (*db));
+      sqlite3_close (*db);
+      *db = NULL;
+      g_unlink (tmp_path);
+    }
+
+  g_free (tmp_path);
+  return backup;
+}
+
+/* Replaces path with a finished copy in one rename.  The copy uses a
+ * rollback journal, so it can be read back without the shared memory WAL
+ * needs. */
+static gboolean
+copy_finish (sqlite3 *db, sqlite3_backup *backup, const gchar *path)
+{
+  gchar *tmp_path;
+  int rc;
+
+  tmp_path = g_strconcat (path, ".sync", NULL);
+
+  rc = sqlite3_backup_finish (backup);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_exec (db, "PRAGMA journal_mode=DELETE;", NULL, NULL, NULL);
+  sqlite3_close (db);
+
+  if (rc != SQLITE_OK || g_rename (tmp_path, path) != 0)
+    {
+      g_warning ("Cannot copy the history to %s: %s", path,
+                 rc != SQLITE_OK ? sqlite3_errstr (rc) : g_strerror (errno));
+      g_unlink (tmp_path);
+      g_free (tmp_path);
+      return FALSE;
+    }
+
+  /* WAL files left next to the old file would be applied to the new one */
+  remove_wal_files (path);
+
+  g_free (tmp_path);
+  return TRUE;
+}
+
+/* Writes a consistent copy of schema to path in one go */
+static gboolean
+copy_database (sqlite3 *source, const gchar *schema, const gchar *path)
+{
+  sqlite3 *db = NULL;
+  sqlite3_backup *backup;
+
+  backup = copy_begin (source, schema, path, &db);
+  if (!backup)
+    return FALSE;
+
+  sqlite3_backup_step (backup, -1);
+
+  return copy_finish (db, backup, path);
+}
+
+/* Replaces the local copy of a database with the synced one, unless the
+ * local one is newer, e.g. after a crash */
+static void
+restore_local_copy (const gchar *home_path, const gchar *local_path)
+{
+  gchar *local_wal = g_strconcat (local_path, "-wal", NULL);
+  gint64 home_mtime = get_mtime (home_path);
+  sqlite3 *db = NULL;
+
+  if (home_mtime >= 0
+      && MAX (get_mtime (local_path), get_mtime (local_wal)) < home_mtime)
+    {
+      if (sqlite3_open_v2 (home_path, &db, SQLITE_OPEN_READWRITE, NULL)
+          == SQLITE_OK)
+        {
+          if (copy_database (db, "main", local_path))
+            g_debug ("Restored %s from %s", local_path, home_path);
+        }
+      sqlite3_close (db);
+    }
+
+  g_free (local_wal);
+}
+
+/* Fills schema of an in-memory database from its synced copy */
+static void
+load_database (sqlite3 *db, const gchar *schema, const gchar *path)
+{
+  sqlite3 *source = NULL;
+  sqlite3_backup *backup;
+
+  if (!g_file_test (path, G_FILE_TEST_EXISTS))
+    return;
+
+  if (sqlite3_open_v2 (path, &source, SQLITE_OPEN_READONLY, NULL)
+      == SQLITE_OK)
+    {
+      backup = sqlite3_backup_init (db, schema, source, "main");
+      if (backup)
+        {
+          sqlite3_backup_step (backup, -1);
+          sqlite3_backup_finish (backup);
+        }
+    }
+  sqlite3_close (source);
+}
+
+static gchar *
+get_sync_path (ClipmanStorage *self, const gchar *name)
+{
+  gchar *basename = g_strconcat (name, ".db", NULL);
+  gchar *path = g_build_filename (self->sync_dir, basename, NULL);
+
+  g_free (basename);
+  return path;
+}
+
+static gboolean
+is_memory_path (const gchar *path)
+{
+  return g_strcmp0 (path, ":memory:") == 0;
+}
+
+static gboolean
+is_archive (guint schema)
+{
+  return g_str_equal (backup_schemas[schema], "archive");
+}
+
+/* Whether tier number S needs a new copy in the sync directory */
+static gboolean
+needs_sync (ClipmanStorage *self, guint s)
+{
+  const gchar *filename = sqlite3_db_filename (self->db, backup_schemas[s]);
+
+  /* Skip an archive that fell back to memory, unless everything is in
+   * memory */
+  if (!filename || (!*filename && !is_memory_path (self->db_path)))
+    return FALSE;
+
+  /* The archive is large and only changes when items move in or out */
+  return !is_archive (s) || self->archive_changed;
+}
+
+static void
+sync_cleanup (ClipmanStorage *self)
+{
+  gchar *tmp_path;
+
+  if (!self->sync_backup)
+    return;
+
+  tmp_path = g_strdup (sqlite3_db_filename (self->sync_db, "main"));
+  sqlite3_backup_finish (self->sync_backup);
+  sqlite3_close (self->sync_db);
+  self->sync_backup = NULL;
+  self->sync_db = NULL;
+
+  if (tmp_path && *tmp_path)
+    g_unlink (tmp_path);
+  g_free (tmp_path);
+}
+
+/* Copies everything at once, for when the storage goes away */
+static void
+sync_to_home (ClipmanStorage *self)
+{
+  sync_cleanup (self);
+  self->sync_again = FALSE;
+
+  for (guint s = 0; s < G_N_ELEMENTS (backup_schemas); s++)
+    {
+      gchar *path;
+
+      if (!needs_sync (self, s))
+        continue;
+
+      path = get_sync_path (self, backup_names[s]);
+      if (copy_database (self->db, backup_schemas[s], path) && is_archive (s))
+        self->archive_changed = FALSE;
+      g_free (path);
+    }
+
+  g_debug ("Synced history to %s", self->sync_dir);
+}
+
+/* Starts copying the next tier that needs it, from sync_schema on */
+static gboolean
+sync_start_schema (ClipmanStorage *self)
+{
+  for (; self->sync_schema < G_N_ELEMENTS (backup_schemas);
+       self->sync_schema++)
+    {
+      gchar *path;
+
+      if (!needs_sync (self, self->sync_schema))
+        continue;
+
+      path = get_sync_path (self, backup_names[self->sync_schema]);
+      self->sync_backup
+          = copy_begin (self->db, backup_schemas[self->sync_schema], path,
+                        &self->sync_db);
+      g_free (path);
+
+      if (self->sync_backup)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean on_sync_step (gpointer user_data);
+static gboolean on_sync_timeout (gpointer user_data);
+
+static gboolean
+on_sync_retry (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+
+  self->sync_id = g_idle_add_full (G_PRIORITY_LOW, on_sync_step, self, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_sync_step (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+  gchar *path;
+  int rc;
+
+  /* Like the backup, the copy follows writes made meanwhile through our
+   * own connection and only holds the source for a few pages at a time */
+  rc = sqlite3_backup_step (self->sync_backup, BACKUP_STEP_PAGES);
+  if (rc == SQLITE_OK)
+    return G_SOURCE_CONTINUE;
+
+  if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+    {
+      self->sync_id = g_timeout_add_seconds (1, on_sync_retry, self);
+      return G_SOURCE_REMOVE;
+    }
+
+  path = get_sync_path (self, backup_names[self->sync_schema]);
+  if (rc == SQLITE_DONE)
+    {
+      if (copy_finish (self->sync_db, self->sync_backup, path)
+          && is_archive (self->sync_schema))
+        self->archive_changed = FALSE;
+      self->sync_backup = NULL;
+      self->sync_db = NULL;
+    }
+  else
+    {
+      g_warning ("Cannot copy the history to %s: %s", path,
+                 sqlite3_errstr (rc));
+      sync_cleanup (self);
+    }
+  g_free (path);
+
+  self->sync_schema++;
+  if (sync_start_schema (self))
+    return G_SOURCE_CONTINUE;
+
+  g_debug ("Synced history to %s", self->sync_dir);
+
+  /* Tiers already copied may have changed since */
+  self->sync_id = 0;
+  if (self->sync_again)
+    {
+      self->sync_again = FALSE;
+      self->sync_id = g_timeout_add_seconds (self->sync_interval,
+                                             on_sync_timeout, self);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_sync_timeout (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+
+  self->sync_id = 0;
+  self->sync_again = FALSE;
+  self->sync_schema = 0;
+
+  if (sync_start_schema (self))
+    self->sync_id
+        = g_idle_add_full (G_PRIORITY_LOW, on_sync_step, self, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_sync (ClipmanStorage *self)
+{
+  if (!self->sync_dir)
+    return;
+
+  /* A copy in progress may already be past the tier that changed */
+  if (self->sync_backup)
+    {
+      self->sync_again = TRUE;
+      return;
+    }
+
+  if (self->sync_id > 0)
+    return;
+
+  self->sync_id = g_timeout_add_seconds (self->sync_interval, on_sync_timeout,
+                                         self);
+}
+
+/* Opens and migrates the databases. This only touches SQLite and the file
+ * system, so it may run in a worker thread; sources and monitors, also
+ * those for writes made while opening, are set up afterwards by
+ * start_services() in the main thread. */
+static gboolean
+open_database (ClipmanStorage *self, GCancellable *cancellable)
+{
+  gchar *data_dir;
+  gchar *archive_path;
+  gchar *archive_wal;
+  gchar *sync_path;
+  int rc;
+
+  self->opening = TRUE;
+
+  if (self->db_path)
+    {
+      /* A history of its own, which doesn't touch the popup snapshot.  In
+       * memory, the archive is too. */
+      if (is_memory_path (self->db_path))
+        archive_path = g_strdup (":memory:");
+      else
+        archive_path = g_strconcat (self->db_path, "-archive", NULL);
+    }
+  else
+    {
+      data_dir = clipman_storage_get_default_dir (
+          self->sync_dir ? NULL : &self->sync_dir);
+      self->snapshot_path = clipman_snapshot_get_default_path ();
+
+      self->db_path = g_build_filename (data_dir, "history.db", NULL);
+      archive_path = g_build_filename (data_dir, "archive.db", NULL);
+      g_free (data_dir);
+    }
+
+  /* Start from the synced copies if they are newer */
+  if (self->sync_dir && !is_memory_path (self->db_path))
+    {
+      sync_path = get_sync_path (self, "history");
+      restore_local_copy (sync_path, self->db_path);
+      g_free (sync_path);
+
+      sync_path = get_sync_path (self, "archive");
+      archive_wal = g_strconcat (archive_path, "-wal", NULL);
+
+      /* An archive changed since its last copy, e.g. before a crash, is
+       * copied again with the next sync */
+      self->archive_changed
+          = get_mtime (sync_path)
+            < MAX (get_mtime (archive_path), get_mtime (archive_wal));
+      restore_local_copy (sync_path, archive_path);
+
+      g_free (archive_wal);
+      g_free (sync_path);
+    }
+
+  /* Open database */
+
+  rc = sqlite3_open (self->db_path, &self->db);
+  if (rc != SQLITE_OK)
+    {
+      g_warning ("Cannot open database: %s", sqlite3_errmsg (self->db));
+      g_free (archive_path);
+      self->opening = FALSE;
+      return FALSE;
+    }
+
+  sqlite3_busy_handler (self->db, on_busy, self);
+
+  /* The page size can only be chosen before the first table is created
+   * and before switching to WAL */
+  if (query_int64 (self, "PRAGMA page_count") == 0)
+    {
+      gchar *sql = g_strdup_printf ("PRAGMA page_size=%d;", NEW_DB_PAGE_SIZE);
+      sqlite3_exec (self->db, sql, NULL, NULL, NULL);
+      g_free (sql);
+    }
+
+  /* Enable WAL mode for better performance */
+  sqlite3_exec (self->db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+  sqlite3_exec (self->db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+
+  /* Rows replaced by INSERT OR REPLACE must fire the stats triggers too */
+  sqlite3_exec (self->db, "PRAGMA recursive_triggers=ON;", NULL, NULL, NULL);
+
+  if (g_cancellable_is_cancelled (cancellable))
+    {
+      g_free (archive_path);
+      self->opening = FALSE;
+      return FALSE;
+    }
+
+  /* Old items live in a separate archive so the hot database, its page
+   * cache and its checkpoints stay small.  Fall back to an in-memory
+   * archive so queries keep working if the file can't be attached. */
+  if (!attach_archive (self, archive_path))
+    attach_archive (self, ":memory:");
+  g_free (archive_path);
+
+  /* An in-memory history starts from its last synced copy */
+  if (self->sync_dir && is_memory_path (self->db_path))
+    {
+      for (guint s = 0; s < G_N_ELEMENTS (backup_schemas); s++)
+        {
+          sync_path = get_sync_path (self, backup_names[s]);
+          load_database (self->db, backup_schemas[s], sync_path);
+          g_free (sync_path);
+        }
+    }
+
+  sqlite3_exec (self->db,
+                "PRAGMA archive.journal_mode=WAL;"
+                "PRAGMA archive.synchronous=NORMAL;",
+                NULL, NULL, NULL);
+  sqlite3_exec (self->db,
+                "PRAGMA archive.cache_size=-"
+                G_STRINGIFY (ARCHIVE_CACHE_SIZE_KIB) ";",
+                NULL, NULL, NULL);
+
+  /* Creating or migrating the schema is the slow part */
+  if (g_cancellable_is_cancelled (cancellable))
+    {
+      self->opening = FALSE;
+      return FALSE;
+    }
+
+  init_database (self, "main");
+  init_database (self, "archive");
+  init_changelog (self);
+  tune_database (self);
+
+  self->opening = FALSE;
+
+  return TRUE;
+}
+
+static void
+start_services (ClipmanStorage *self)
+{
+  /* Timers for what was written while opening */
+  if (self->changed_while_opening)
+    {
+      self->changed_while_opening = FALSE;
+      schedule_backup (self);
+      schedule_sync (self);
+    }
+
+  schedule_migration (self);
+
+  /* No other process can see an in-memory history */
+  if (!is_memory_path (self->db_path))
+    watch_external_changes (self);
+
+  /* Catch up with changes made while no instance was running */
+  schedule_snapshot (self);
+}
+
+ClipmanStorage *
+clipman_storage_new (void)
+{
+  ClipmanStorage *self = g_object_new (CLIPMAN_TYPE_STORAGE, NULL);
+
+  if (open_database (self, NULL))
+    start_services (self);
+
+  return self;
+}
+
+ClipmanStorage *
+clipman_storage_new_for_path (const gchar *path, const gchar *sync_dir)
+{
+  ClipmanStorage *self;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  self = g_object_new (CLIPMAN_TYPE_STORAGE, "path", path, "sync-dir",
+                       sync_dir, NULL);
+  if (sync_dir)
+    g_mkdir_with_parents (sync_dir, 0700);
+
+  if (open_database (self, NULL))
+    start_services (self);
+
+  return self;
+}
+
+static void
+open_in_thread (GTask *task, gpointer source_object, gpointer task_data,
+                GCancellable *cancellable)
+{
+  if (open_database (CLIPMAN_STORAGE (source_object), cancellable))
+    g_task_return_boolean (task, TRUE);
+  else if (!g_task_return_error_if_cancelled (task))
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Cannot open the history database");
+}
+
+static void
+on_open_done (GObject *source_object, GAsyncResult *result,
+              gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  GError *error = NULL;
+
+  if (g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      start_services (CLIPMAN_STORAGE (source_object));
+      g_task_return_boolean (task, TRUE);
+    }
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+void
+clipman_storage_new_async (GCancellable *cancellable,
+                           GAsyncReadyCallback callback, gpointer user_data)
+{
+  ClipmanStorage *self = g_object_new (CLIPMAN_TYPE_STORAGE, NULL);
+  GTask *task;
+  GTask *open_task;
+
+  /* Opening may have to create tables or migrate an old schema, so keep
+   * it off the main loop; the storage is handed out once it is ready */
+  task = g_task_new (self, cancellable, callback, user_data);
+  open_task = g_task_new (self, cancellable, on_open_done, task);
+  g_task_run_in_thread (open_task, open_in_thread);
+
+  g_object_unref (open_task);
+  g_object_unref (self);
+}
+
+ClipmanStorage *
+clipman_storage_new_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  if (!g_task_propagate_boolean (G_TASK (result), error))
+    return NULL;
+
+  return g_object_ref (g_task_get_source_object (G_TASK (result)));
+}
+
+/* Whether either tier holds an item with this checksum */
+static gboolean
+has_checksum (ClipmanStorage *self, const gchar *checksum)
+{
+  sqlite3_stmt *stmt;
+  gboolean found;
+
+  if (sqlite3_prepare_v2 (self->db,
+                          "SELECT 1 FROM main.items WHERE checksum = ?1 "
+                          "UNION ALL SELECT 1 FROM archive.items "
+                          "WHERE checksum = ?1 LIMIT 1",
+                          -1, &stmt, NULL)
+      != SQLITE_OK)
+    return FALSE;
+
+  sqlite3_bind_text (stmt, 1, checksum, -1, SQLITE_STATIC);
+  found = sqlite3_step (stmt) == SQLITE_ROW;
+  sqlite3_finalize (stmt);
+
+  return found;
+}
+
+/* Items fresh from the clipboard carry the PNG their checksum was taken
+ * from; only those rebuilt from a history row need encoding again */
+static GBytes *
+get_png (ClipmanItem *item)
+{
+  GBytes *png = clipman_item_get_png (item);
+  gchar *buffer;
+  gsize size;
+
+  if (png)
+    return g_bytes_ref (png);
+
+  if (!gdk_pixbuf_save_to_buffer (clipman_item_get_pixbuf (item), &buffer,
+                                  &size, "png", NULL, NULL))
+    return NULL;
+
+  return g_bytes_new_take (buffer, size);
+}
+
+static int
+write_item (ClipmanStorage *self, ClipmanItem *item, GBytes *png,
+            gint64 *id, gboolean *inserted)
+{
+  GBytes *encoded = NULL;
+  sqlite3_stmt *stmt;
+  const gchar *sql;
+  ClipmanItemType type;
+  int rc;
+
+  type = clipman_item_get_item_type (item);
+  *inserted = FALSE;
+
+  /* First, check if item already exists in either tier */
+  sql = "SELECT id, 0 FROM main.items WHERE checksum = ?1 "
+        "UNION ALL SELECT id, 1 FROM archive.items WHERE checksum = ?1";
+  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  sqlite3_bind_text (stmt, 1, clipman_item_get_checksum (item), -1,
+                     SQLITE_STATIC);
+  rc = sqlite3_step (stmt);
+  if (rc == SQLITE_ROW)
+    {
+      gboolean archived;
+
+      /* Item exists - update timestamp to move it to top */
+      *id = sqlite3_column_int64 (stmt, 0);
+      archived = sqlite3_column_int (stmt, 1);
+      sqlite3_finalize (stmt);
+
+      if (archived)
+        restore_from_archive (self, *id);
+
+      sql = "UPDATE main.items SET timestamp = ? WHERE id = ?";
+      rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+      if (rc != SQLITE_OK)
+        return rc;
+
+      sqlite3_bind_int64 (stmt, 1, g_get_real_time () / 1000000);
+      sqlite3_bind_int64 (stmt, 2, *id);
+      rc = sqlite3_step (stmt);
+      sqlite3_finalize (stmt);
+
+      return rc;
+    }
+  sqlite3_finalize (stmt);
+
+  if (rc != SQLITE_DONE)
+    return rc;
+
+  /* Insert new item */
+  sql = "INSERT INTO main.items (type, source, checksum, label, text_content, "
+        "image_data, timestamp) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?)";
+
+  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  sqlite3_bind_int (stmt, 1, type);
+  sqlite3_bind_int (stmt, 2, clipman_item_get_source (item));
+  sqlite3_bind_text (stmt, 3, clipman_item_get_checksum (item), -1,
+                     SQLITE_STATIC);
+  sqlite3_bind_text (stmt, 4, clipman_item_get_label (item), -1,
+                     SQLITE_STATIC);
+
+  if (type == CLIPMAN_ITEM_TYPE_TEXT || type == CLIPMAN_ITEM_TYPE_FILES)
+    {
+      sqlite3_bind_text (stmt, 5, clipman_item_get_text (item), -1,
+                         SQLITE_STATIC);
+      sqlite3_bind_null (stmt, 6);
+    }
+  else if (type == CLIPMAN_ITEM_TYPE_IMAGE)
+    {
+      sqlite3_bind_null (stmt, 5);
+
+      /* Removed by another process since add_item() looked */
+      if (!png)
+        png = encoded = get_png (item);
+
+      if (png)
+        sqlite3_bind_blob (stmt, 6, g_bytes_get_data (png, NULL),
+                           g_bytes_get_size (png), SQLITE_STATIC);
+      else
+        sqlite3_bind_null (stmt, 6);
+    }
+
+  sqlite3_bind_int64 (stmt, 7, g_get_real_time () / 1000000);
+
+  rc = sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
+  if (encoded)
+    g_bytes_unref (encoded);
+
+  if (rc == SQLITE_DONE)
+    {
+      *id = sqlite3_last_insert_rowid (self->db);
+      *inserted = TRUE;
+    }
+
+  return rc;
+}
+
+gboolean
+clipman_storage_add_item (ClipmanStorage *self, ClipmanItem *item)
+{
+  GBytes *png = NULL;
+  gboolean inserted = FALSE;
+  gint64 id = 0;
+  gint64 start;
+  int rc;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
+  g_return_val_if_fail (CLIPMAN_IS_ITEM (item), FALSE);
+
+  /* Encode new images before taking the write lock so it is held as
+   * briefly as possible; a copied again image only has its timestamp
+   * bumped and needs no PNG */
+  if (clipman_item_get_item_type (item) == CLIPMAN_ITEM_TYPE_IMAGE
+      && !has_checksum (self, clipman_item_get_checksum (item)))
+    png = get_png (item);
+
+  start = g_get_monotonic_time ();
+  if (!begin_write (self))
+    {
+      if (png)
+        g_bytes_unref (png);
+      return FALSE;
+    }
+
+  rc = write_item (self, item, png, &id, &inserted);
+  if (png)
+    g_bytes_unref (png);
+
+  if (rc != SQLITE_DONE)
+    {
+      g_warning ("Failed to store item: %s", sqlite3_errmsg (self->db));
+      end_write (self, FALSE);
+      return FALSE;
+    }
+
+  if (!end_write (self, TRUE))
+    {
+      g_warning ("Failed to commit item: %s", sqlite3_errmsg (self->db));
+      return FALSE;
+    }
+  clipman_latency_record (CLIPMAN_STAGE_COMMIT, start);
+
+  clipman_item_set_id (item, id);
+  schedule_snapshot (self);
+
+  if (!inserted)
+    return TRUE;
+
+  maybe_retune_database (self);
+  schedule_migration (self);
+
+  g_signal_emit (self, signals[SIGNAL_ITEM_ADDED], 0, item);
+
+  return TRUE;
+}
+
+gboolean
+clipman_storage_remove_item (ClipmanStorage *self, gint64 id)
+{
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
+
+  if (!begin_write (self))
+    return FALSE;
+
+  if (!end_write (
+          self,
+          exec_with_id (self, "DELETE FROM main.items WHERE id = ?", id)
+              && exec_with_id (self, "DELETE FROM archive.items WHERE id = ?",
+                               id)))
+    return FALSE;
+
+  self->archive_changed = TRUE;
+  schedule_snapshot (self);
+  g_signal_emit (self, signals[SIGNAL_ITEM_REMOVED], 0, id);
+
+  return TRUE;
+}
+
+static ClipmanItem *
+item_from_row (sqlite3_stmt *stmt)
+{
+  ClipmanItem *item = NULL;
+  ClipmanItemType type;
+  ClipmanSource source;
+  const gchar *checksum;
+  const gchar *label;
+  const gchar *text;
+  const void *blob;
+  int blob_size;
+
+  type = sqlite3_column_int (stmt, 1);
+  source = sqlite3_column_int (stmt, 2);
+  checksum = (const gchar *)sqlite3_column_text (stmt, 3);
+  label = (const gchar *)sqlite3_column_text (stmt, 4);
+
+  if (!checksum)
+    return NULL;
+
+  switch (type)
+    {
+    case CLIPMAN_ITEM_TYPE_TEXT:
+    case CLIPMAN_ITEM_TYPE_FILES:
+      text = (const gchar *)sqlite3_column_text (stmt, 5);
+      if (text)
+        item = clipman_item_new_stored (type, source, checksum, label, text,
+                                        NULL);
+      break;
+
+    case CLIPMAN_ITEM_TYPE_IMAGE:
+      blob = sqlite3_column_blob (stmt, 6);
+      blob_size = sqlite3_column_bytes (stmt, 6);
+      if (blob && blob_size > 0)
+        {
+          GInputStream *stream = g_memory_input_stream_new_from_data (
+              g_memdup2 (blob, blob_size), blob_size, g_free);
+          GdkPixbuf *pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
+          g_object_unref (stream);
+          if (pixbuf)
+            {
+              item = clipman_item_new_stored (type, source, checksum, label,
+                                              NULL, pixbuf);
+              g_object_unref (pixbuf);
+            }
+        }
+      break;
+    }
+
+  if (item)
+    {
+      clipman_item_set_id (item, sqlite3_column_int64 (stmt, 0));
+      clipman_item_set_timestamp (item, sqlite3_column_int64 (stmt, 7));
+    }
+
+  return item;
+}
+
+ClipmanItem *
+clipman_storage_get_item (ClipmanStorage *self, gint64 id)
+{
+  sqlite3_stmt *stmt;
+  ClipmanItem *item = NULL;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
+
+  if (sqlite3_prepare_v2 (self->db,
+                          "SELECT " ITEM_COLUMNS " FROM main.items "
+                          "WHERE id = ?1 UNION ALL "
+                          "SELECT " ITEM_COLUMNS " FROM archive.items "
+                          "WHERE id = ?1 LIMIT 1",
+                          -1, &stmt, NULL)
+      != SQLITE_OK)
+    return NULL;
+
+  sqlite3_bind_int64 (stmt, 1, id);
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    item = item_from_row (stmt);
+
+  sqlite3_finalize (stmt);
+
+  return item;
+}
+
+static void
+emit_external_changes (ClipmanStorage *self)
+{
+  sqlite3_stmt *stmt;
+  GArray *changes;
+
+  if (sqlite3_prepare_v2 (self->db,
+                          "SELECT seq, item_id, op, origin "
+                          "FROM main.changelog WHERE seq > ? ORDER BY seq",
+                          -1, &stmt, NULL)
+      != SQLITE_OK)
+    return;
+
+  /* Collect first, handlers may run their own queries */
+  changes = g_array_new (FALSE, FALSE, sizeof (ChangeEntry));
+  sqlite3_bind_int64 (stmt, 1, self->last_seq);
+
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      ChangeEntry entry;
+
+      self->last_seq = sqlite3_column_int64 (stmt, 0);
+      if (sqlite3_column_int (stmt, 3) == self->origin)
+        continue;
+
+      entry.item_id = sqlite3_column_int64 (stmt, 1);
+      entry.op = sqlite3_column_int (stmt, 2);
+      g_array_append_val (changes, entry);
+    }
+
+  sqlite3_finalize (stmt);
+
+  if (changes->len > 0)
+    schedule_snapshot (self);
+
+  if (changes->len > CHANGES_EMIT_MAX)
+    {
+      g_signal_emit (self, signals[SIGNAL_CHANGED], 0);
+      g_array_free (changes, TRUE);
+      return;
+    }
+
+  for (guint i = 0; i < changes->len; i++)
+    {
+      ChangeEntry *entry = &g_array_index (changes, ChangeEntry, i);
+
+      switch (entry->op)
+        {
+        case CHANGE_ITEM_ADDED:
+          {
+            ClipmanItem *item
+                = clipman_storage_get_item (self, entry->item_id);
+
+            /* Items already removed again show up as a later removal */
+            if (item)
+              {
+                g_signal_emit (self, signals[SIGNAL_ITEM_ADDED], 0, item);
+                g_object_unref (item);
+              }
+          }
+          break;
+
+        case CHANGE_ITEM_REMOVED:
+          g_signal_emit (self, signals[SIGNAL_ITEM_REMOVED], 0,
+                         entry->item_id);
+          break;
+
+        case CHANGE_ITEM_UPDATED:
+          /* Like a local copy again, this only reorders the snapshot */
+          break;
+        }
+    }
+
+  g_array_free (changes, TRUE);
+}
+
+static gboolean
+on_check_changes (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+  gint64 version;
+
+  self->changes_idle_id = 0;
+
+  /* data_version only moves when another connection commits */
+  version = query_int64 (self, "PRAGMA data_version");
+  if (version != self->data_version)
+    {
+      self->data_version = version;
+      emit_external_changes (self);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+on_wal_changed (GFileMonitor *monitor, GFile *file, GFile *other_file,
+                GFileMonitorEvent event_type, gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+
+  if (self->changes_idle_id == 0)
+    self->changes_idle_id = g_idle_add (on_check_changes, self);
+}
+
+static void
+watch_external_changes (ClipmanStorage *self)
+{
+  gchar *wal_path;
+  GFile *file;
+
+  /* Every commit in WAL mode touches the -wal file, so inotify tells us
+   * about other writers without any polling */
+  wal_path = g_strconcat (self->db_path, "-wal", NULL);
+  file = g_file_new_for_path (wal_path);
+
+  self->wal_monitor
+      = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+  if (self->wal_monitor)
+    {
+      g_file_monitor_set_rate_limit (self->wal_monitor,
+                                     WAL_MONITOR_RATE_LIMIT);
+      g_signal_connect (self->wal_monitor, "changed",
+                        G_CALLBACK (on_wal_changed), self);
+    }
+
+  g_object_unref (file);
+  g_free (wal_path);
+}
+
+GList *
+clipman_storage_get_items (ClipmanStorage *self, gint limit)
+{
+  sqlite3_stmt *stmt;
+  const gchar *sql = "SELECT " ITEM_COLUMNS " FROM main.items "
+                     "ORDER BY timestamp DESC LIMIT ?";
+  GList *items = NULL;
+  int rc;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
+
+  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+    return NULL;
+
+  sqlite3_bind_int (stmt, 1, limit > 0 ? limit : 100);
+
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      ClipmanItem *item = item_from_row (stmt);
+      if (item)
+        items = g_list_append (items, item);
+    }
+
+  sqlite3_finalize (stmt);
+
+  return items;
+}
+
+ClipmanItem *
+clipman_storage_get_by_checksum (ClipmanStorage *self, const gchar *checksum)
+{
+  sqlite3_stmt *stmt;
+  const gchar *sql = "SELECT " ITEM_COLUMNS " FROM main.items "
+                     "WHERE checksum = ?1 "
+                     "UNION ALL SELECT " ITEM_COLUMNS " FROM archive.items "
+                     "WHERE checksum = ?1 LIMIT 1";
+  ClipmanItem *item = NULL;
+  int rc;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
+  g_return_val_if_fail (checksum != NULL, NULL);
+
+  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+    return NULL;
+
+  sqlite3_bind_text (stmt, 1, checksum, -1, SQLITE_STATIC);
+
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      item = item_from_row (stmt);
+    }
+
+  sqlite3_finalize (stmt);
+
+  return item;
+}
+
+gboolean
+clipman_storage_clear (ClipmanStorage *self)
+{
+  char *err = NULL;
+  int rc;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
+
+  if (!begin_write (self))
+    return FALSE;
+
+  rc = sqlite3_exec (self->db,
+                     "DELETE FROM main.items; DELETE FROM archive.items;",
+                     NULL, NULL, &err);
+  if (rc != SQLITE_OK)
+    {
+      g_warning ("Failed to clear history: %s", err);
+      sqlite3_free (err);
+      end_write (self, FALSE);
+      return FALSE;
+    }
+
+  if (!end_write (self, TRUE))
+    return FALSE;
+
+  self->archive_changed = TRUE;
+  schedule_snapshot (self);
+  g_signal_emit (self, signals[SIGNAL_CLEARED], 0);
+
+  return TRUE;
+}
+
+/* Adds one page of list rows from SQL taking the pattern as ?1, the limit
+ * as ?2 and the offset as ?3, and returns how many there were */
+static gint64
+list_rows (ClipmanStorage *self, const gchar *sql, const gchar *query,
+           gint64 offset, gint64 limit, GVariantBuilder *builder)
+{
+  sqlite3_stmt *stmt;
+  gint64 n_rows = 0;
+
+  if (sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    return 0;
+
+  if (query)
+    sqlite3_bind_text (stmt, 1, g_strdup_printf ("%%%s%%", query), -1,
+                       g_free);
+  sqlite3_bind_int64 (stmt, 2, limit);
+  sqlite3_bind_int64 (stmt, 3, offset);
+
+  /* Only metadata is read, so listing images never decodes them */
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      const gchar *label = (const gchar *)sqlite3_column_text (stmt, 3);
+
+      g_variant_builder_add (builder, CLIPMAN_ITEM_VARIANT_TYPE,
+                             (gint64) sqlite3_column_int64 (stmt, 0),
+                             (guint32) sqlite3_column_int (stmt, 1),
+                             (guint32) sqlite3_column_int (stmt, 2),
+                             label ? label : "",
+                             (gint64) sqlite3_column_int64 (stmt, 4));
+      n_rows++;
+    }
+
+  sqlite3_finalize (stmt);
+
+  return n_rows;
+}
+
+GVariant *
+clipman_storage_list (ClipmanStorage *self, const gchar *query, guint offset,
+                      guint limit)
+{
+  GVariantBuilder builder;
+  gint64 n_hot;
+  gint64 n_rows;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
+
+  g_variant_builder_init (&builder,
+                          G_VARIANT_TYPE ("a" CLIPMAN_ITEM_VARIANT_TYPE));
+
+  if (query)
+    {
+      list_rows (self,
+                 "SELECT id, type, source, label, timestamp FROM main.items "
+                 "WHERE text_content LIKE ?1 OR label LIKE ?1 "
+                 "UNION ALL SELECT id, type, source, label, timestamp "
+                 "FROM archive.items "
+                 "WHERE text_content LIKE ?1 OR label LIKE ?1 "
+                 "ORDER BY timestamp DESC, id DESC LIMIT ?2 OFFSET ?3",
+                 query, offset, limit > 0 ? (gint64) limit : -1, &builder);
+      return g_variant_builder_end (&builder);
+    }
+
+  /* Everything in the archive is older than the hot tier, so a page is
+   * read off the timestamp index of one tier and only continues into the
+   * archive once the hot items run out */
+  n_rows = list_rows (self,
+                      "SELECT id, type, source, label, timestamp "
+                      "FROM main.items ORDER BY timestamp DESC, id DESC "
+                      "LIMIT ?2 OFFSET ?3",
+                      NULL, offset, limit > 0 ? (gint64) limit : -1,
+                      &builder);
+  if (limit > 0 && n_rows == limit)
+    return g_variant_builder_end (&builder);
+
+  /* A page past the hot tier needs its size to offset into the archive */
+  n_hot = n_rows > 0 || offset == 0
+              ? offset + n_rows
+              : query_int64 (self, "SELECT count(*) FROM main.items");
+
+  list_rows (self,
+             "SELECT id, type, source, label, timestamp "
+             "FROM archive.items ORDER BY timestamp DESC, id DESC "
+             "LIMIT ?2 OFFSET ?3",
+             NULL, MAX ((gint64) offset - n_hot, 0),
+             limit > 0 ? (gint64) limit - n_rows : -1, &builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+GBytes *
+clipman_storage_get_content (ClipmanStorage *self, gint64 id,
+                             ClipmanItemType *type)
+{
+  sqlite3_stmt *stmt;
+  const gchar *sql
+      = "SELECT type, coalesce(CAST(text_content AS BLOB), image_data) "
+        "FROM main.items WHERE id = ?1 "
+        "UNION ALL SELECT type, "
+        "coalesce(CAST(text_content AS BLOB), image_data) "
+        "FROM archive.items WHERE id = ?1 LIMIT 1";
+  GBytes *bytes = NULL;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
+
+  if (sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    return NULL;
+
+  sqlite3_bind_int64 (stmt, 1, id);
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      if (type)
+        *type = sqlite3_column_int (stmt, 0);
+
+      /* The stored bytes as they are: UTF-8 text, a URI list or PNG */
+      bytes = g_bytes_new (sqlite3_column_blob (stmt, 1),
+                           sqlite3_column_bytes (stmt, 1));
+    }
+
+  sqlite3_finalize (stmt);
+
+  return bytes;
+}
+
+GList *
+clipman_storage_search (ClipmanStorage *self, const gchar *query, gint limit)
+{
+  sqlite3_stmt *stmt;
+  const gchar *sql = "SELECT " ITEM_COLUMNS " FROM main.items "
+                     "WHERE text_content LIKE ?1 OR label LIKE ?1 "
+                     "UNION ALL SELECT " ITEM_COLUMNS " FROM archive.items "
+                     "WHERE text_content LIKE ?1 OR label LIKE ?1 "
+                     "ORDER BY timestamp DESC LIMIT ?2";
+  GList *items = NULL;
+  gchar *pattern;
+  int rc;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
+  g_return_val_if_fail (query != NULL, NULL);
+
+  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
     return NULL;
 
-  sqlite3_bind_text (stmt, 1, checksum, -1, SQLITE_STATIC);
+  pattern = g_strdup_printf ("%%%s%%", query);
+  sqlite3_bind_text (stmt, 1, pattern, -1, SQLITE_TRANSIENT);
+  sqlite3_bind_int (stmt, 2, limit > 0 ? limit : 100);
+  g_free (pattern);
+
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+      ClipmanItem *item = item_from_row (stmt);
+      if (item)
+        items = g_list_append (items, item);
+    }
+
+  sqlite3_finalize (stmt);
+
+  return items;
+}
+
+gboolean
+clipman_storage_get_stats (ClipmanStorage *self, ClipmanStorageStats *stats)
+{
+  sqlite3_stmt *stmt;
+  const gchar *sql = "SELECT type, source, count, bytes FROM main.stats "
+                     "UNION ALL "
+                     "SELECT type, source, count, bytes FROM archive.stats";
+  int rc;
+
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
+  g_return_val_if_fail (stats != NULL, FALSE);
 
-  if (sqlite3_step (stmt) == SQLITE_ROW)
+  memset (stats, 0, sizeof (ClipmanStorageStats));
+  stats->n_contended = self->n_contended;
+
+  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+    return FALSE;
+
+  while (sqlite3_step (stmt) == SQLITE_ROW)
     {
-      item = item_from_row (stmt);
+      gint type = sqlite3_column_int (stmt, 0);
+      gint source = sqlite3_column_int (stmt, 1);
+      gint64 count = sqlite3_column_int64 (stmt, 2);
+      gint64 bytes = sqlite3_column_int64 (stmt, 3);
+
+      if (type < 0 || type >= CLIPMAN_N_ITEM_TYPES || source < 0
+          || source >= CLIPMAN_N_SOURCES)
+        continue;
+
+      stats->n_items[type][source] += count;
+      stats->n_bytes[type][source] += bytes;
+      stats->total_items += count;
+      stats->total_bytes += bytes;
     }
 
   sqlite3_finalize (stmt);
 
-  return item;
+  return TRUE;
+}
+
+static gboolean
+write_base64 (GOutputStream *stream, const guchar *data, gsize len,
+              GCancellable *cancellable, GError **error)
+{
+  gchar out[(EXPORT_CHUNK / 3 + 1) * 4 + 4];
+  gint state = 0;
+  gint save = 0;
+  gsize n;
+
+  /* Encode in chunks so large payloads are never duplicated in memory */
+  for (gsize offset = 0; offset < len; offset += EXPORT_CHUNK)
+    {
+      n = g_base64_encode_step (data + offset,
+                                MIN (EXPORT_CHUNK, len - offset), FALSE, out,
+                                &state, &save);
+      if (!g_output_stream_write_all (stream, out, n, NULL, cancellable,
+                                      error))
+        return FALSE;
+    }
+
+  n = g_base64_encode_close (FALSE, out, &state, &save);
+
+  return g_output_stream_write_all (stream, out, n, NULL, cancellable, error);
 }
 
 gboolean
-clipman_storage_clear (ClipmanStorage *self)
+clipman_storage_export (ClipmanStorage *self, GOutputStream *stream,
+                        GCancellable *cancellable, GError **error)
 {
-  char *err = NULL;
+  sqlite3_stmt *stmt;
+  const gchar *sql = "SELECT " ITEM_COLUMNS " FROM main.items "
+                     "UNION ALL SELECT " ITEM_COLUMNS " FROM archive.items "
+                     "ORDER BY timestamp";
+  GOutputStream *out;
+  gboolean ok;
   int rc;
 
   g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
 
-  rc = sqlite3_exec (self->db, "DELETE FROM items", NULL, NULL, &err);
+  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
   if (rc != SQLITE_OK)
     {
-      g_warning ("Failed to clear history: %s", err);
-      sqlite3_free (err);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to query history: %s", sqlite3_errmsg (self->db));
       return FALSE;
     }
 
-  g_signal_emit (self, signals[SIGNAL_CLEARED], 0);
+  out = g_buffered_output_stream_new_sized (stream, 64 * 1024);
+  g_filter_output_stream_set_close_base_stream (
+      G_FILTER_OUTPUT_STREAM (out), FALSE);
+
+  ok = g_output_stream_write_all (out, EXPORT_HEADER "\n",
+                                  strlen (EXPORT_HEADER "\n"), NULL,
+                                  cancellable, error);
+
+  /* Rows are streamed straight from SQLite to the output, one at a time */
+  while (ok && (rc = sqlite3_step (stmt)) == SQLITE_ROW)
+    {
+      gint type = sqlite3_column_int (stmt, 1);
+      gint payload_column = type == CLIPMAN_ITEM_TYPE_IMAGE ? 6 : 5;
+      const guchar *label = sqlite3_column_text (stmt, 4);
+      const guchar *payload;
+      gchar *prefix;
+
+      prefix = g_strdup_printf ("%d\t%d\t%" G_GINT64_FORMAT "\t%s\t", type,
+                                sqlite3_column_int (stmt, 2),
+                                sqlite3_column_int64 (stmt, 7),
+                                sqlite3_column_text (stmt, 3));
+      ok = g_output_stream_write_all (out, prefix, strlen (prefix), NULL,
+                                      cancellable, error);
+      g_free (prefix);
+
+      ok = ok
+           && write_base64 (out, label, sqlite3_column_bytes (stmt, 4),
+                            cancellable, error)
+           && g_output_stream_write_all (out, "\t", 1, NULL, cancellable,
+                                         error);
+
+      payload = sqlite3_column_blob (stmt, payload_column);
+      ok = ok
+           && write_base64 (out, payload,
+                            sqlite3_column_bytes (stmt, payload_column),
+                            cancellable, error)
+           && g_output_stream_write_all (out, "\n", 1, NULL, cancellable,
+                                         error);
+    }
+
+  if (ok && rc != SQLITE_DONE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to read history: %s", sqlite3_errmsg (self->db));
+      ok = FALSE;
+    }
+
+  sqlite3_finalize (stmt);
+
+  ok = ok && g_output_stream_flush (out, cancellable, error);
+  g_object_unref (out);
+
+  return ok;
+}
+
+typedef struct
+{
+  gchar *line;
+  gboolean valid;
+  ClipmanItemType type;
+  ClipmanSource source;
+  gint64 timestamp;
+  gchar *checksum;
+  gchar **fields;
+  guchar *label;
+  gsize label_len;
+  guchar *payload;
+  gsize payload_len;
+} ImportRecord;
+
+typedef struct
+{
+  GMutex lock;
+  GCond done;
+  guint pending;
+} ImportBatch;
+
+static void
+import_record_clear (ImportRecord *record)
+{
+  g_free (record->line);
+  g_free (record->checksum);
+  g_strfreev (record->fields);
+  memset (record, 0, sizeof (ImportRecord));
+}
+
+static void
+import_record_parse (ImportRecord *record)
+{
+  gchar **fields;
+  gint64 type;
+  gint64 source;
+
+  fields = g_strsplit (record->line, "\t", EXPORT_FIELDS);
+  record->fields = fields;
+
+  if (g_strv_length (fields) != EXPORT_FIELDS)
+    return;
+
+  type = g_ascii_strtoll (fields[0], NULL, 10);
+  source = g_ascii_strtoll (fields[1], NULL, 10);
+  if (type < 0 || type >= CLIPMAN_N_ITEM_TYPES || source < 0
+      || source >= CLIPMAN_N_SOURCES)
+    return;
+
+  record->type = type;
+  record->source = source;
+  record->timestamp = g_ascii_strtoll (fields[2], NULL, 10);
+
+  /* Decode in place, the payload is the bulk of the line */
+  record->label = g_base64_decode_inplace (fields[4], &record->label_len);
+  record->payload = g_base64_decode_inplace (fields[5], &record->payload_len);
+
+  if (record->payload_len == 0)
+    return;
+
+  if (record->type != CLIPMAN_ITEM_TYPE_IMAGE
+      && !g_utf8_validate ((const gchar *)record->payload,
+                           record->payload_len, NULL))
+    return;
+
+  /* The stored checksum is not trusted, it decides deduplication */
+  record->checksum = g_compute_checksum_for_data (
+      G_CHECKSUM_SHA1, record->payload, record->payload_len);
+  record->valid = TRUE;
+}
+
+static void
+import_worker (gpointer data, gpointer user_data)
+{
+  ImportRecord *record = data;
+  ImportBatch *batch = user_data;
+
+  import_record_parse (record);
+
+  g_mutex_lock (&batch->lock);
+  if (--batch->pending == 0)
+    g_cond_signal (&batch->done);
+  g_mutex_unlock (&batch->lock);
+}
+
+static gboolean
+import_commit (ClipmanStorage *self, sqlite3_stmt *stmt,
+               ImportRecord *records, guint n_records, guint *n_imported,
+               GError **error)
+{
+  int rc = SQLITE_DONE;
+
+  if (!begin_write (self))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                   "Failed to start transaction: %s",
+                   sqlite3_errmsg (self->db));
+      return FALSE;
+    }
+
+  for (guint i = 0; i < n_records && rc == SQLITE_DONE; i++)
+    {
+      ImportRecord *record = &records[i];
+
+      if (!record->valid)
+        continue;
+
+      sqlite3_bind_int (stmt, 1, record->type);
+      sqlite3_bind_int (stmt, 2, record->source);
+      sqlite3_bind_text (stmt, 3, record->checksum, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, 4, (const gchar *)record->label,
+                         record->label_len, SQLITE_STATIC);
+
+      if (record->type == CLIPMAN_ITEM_TYPE_IMAGE)
+        {
+          sqlite3_bind_null (stmt, 5);
+          sqlite3_bind_blob (stmt, 6, record->payload, record->payload_len,
+                             SQLITE_STATIC);
+        }
+      else
+        {
+          sqlite3_bind_text (stmt, 5, (const gchar *)record->payload,
+                             record->payload_len, SQLITE_STATIC);
+          sqlite3_bind_null (stmt, 6);
+        }
+
+      sqlite3_bind_int64 (stmt, 7, record->timestamp);
+
+      rc = sqlite3_step (stmt);
+      if (rc == SQLITE_DONE)
+        *n_imported += sqlite3_changes (self->db);
+
+      sqlite3_reset (stmt);
+      sqlite3_clear_bindings (stmt);
+    }
+
+  if (rc != SQLITE_DONE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to import items: %s", sqlite3_errmsg (self->db));
+      end_write (self, FALSE);
+      return FALSE;
+    }
+
+  if (!end_write (self, TRUE))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to commit imported items: %s",
+                   sqlite3_errmsg (self->db));
+      return FALSE;
+    }
 
   return TRUE;
 }
 
-GList *
-clipman_storage_search (ClipmanStorage *self, const gchar *query, gint limit)
+gboolean
+clipman_storage_import (ClipmanStorage *self, GInputStream *stream,
+                        guint *n_imported, GCancellable *cancellable,
+                        GError **error)
 {
+  const gchar *sql
+      = "INSERT OR IGNORE INTO main.items (type, source, checksum, label, "
+        "text_content, image_data, timestamp) "
+        "SELECT ?1, ?2, ?3, ?4, ?5, ?6, ?7 WHERE NOT EXISTS "
+        "(SELECT 1 FROM archive.items WHERE checksum = ?3)";
+  GDataInputStream *in;
+  GThreadPool *pool;
+  ImportRecord *records;
+  ImportBatch batch;
   sqlite3_stmt *stmt;
-  const gchar *sql = "SELECT id, type, source, checksum, label, text_content, "
-                     "image_data, timestamp "
-                     "FROM items WHERE text_content LIKE ? OR label LIKE ? "
-                     "ORDER BY timestamp DESC LIMIT ?";
-  GList *items = NULL;
-  gchar *pattern;
-  int rc;
+  gchar *line;
+  guint n_records = 0;
+  gsize batch_bytes;
+  gsize length;
+  guint imported = 0;
+  gboolean ok = TRUE;
+  gboolean eof = FALSE;
 
-  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), NULL);
-  g_return_val_if_fail (query != NULL, NULL);
+  g_return_val_if_fail (CLIPMAN_IS_STORAGE (self), FALSE);
+  g_return_val_if_fail (G_IS_INPUT_STREAM (stream), FALSE);
 
-  rc = sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL);
-  if (rc != SQLITE_OK)
-    return NULL;
+  if (sqlite3_prepare_v2 (self->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to prepare import: %s", sqlite3_errmsg (self->db));
+      return FALSE;
+    }
 
-  pattern = g_strdup_printf ("%%%s%%", query);
-  sqlite3_bind_text (stmt, 1, pattern, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, 2, pattern, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int (stmt, 3, limit > 0 ? limit : 100);
-  g_free (pattern);
+  in = g_data_input_stream_new (stream);
+  g_filter_input_stream_set_close_base_stream (G_FILTER_INPUT_STREAM (in),
+                                               FALSE);
+  g_buffered_input_stream_set_buffer_size (G_BUFFERED_INPUT_STREAM (in),
+                                           64 * 1024);
 
-  while (sqlite3_step (stmt) == SQLITE_ROW)
+  line = g_data_input_stream_read_line (in, NULL, cancellable, error);
+  if (g_strcmp0 (line, EXPORT_HEADER) != 0)
     {
-      ClipmanItem *item = item_from_row (stmt);
-      if (item)
-        items = g_list_append (items, item);
+      if (line || (error && !*error))
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Not a clipboard history export");
+      g_free (line);
+      g_object_unref (in);
+      sqlite3_finalize (stmt);
+      return FALSE;
+    }
+  g_free (line);
+
+  /* Lines are decoded and hashed on a thread pool while the main thread
+   * commits each batch in a single transaction */
+  records = g_new0 (ImportRecord, IMPORT_BATCH);
+  g_mutex_init (&batch.lock);
+  g_cond_init (&batch.done);
+  pool = g_thread_pool_new (import_worker, &batch,
+                            g_get_num_processors (), FALSE, NULL);
+
+  while (ok && !eof)
+    {
+      GError *read_error = NULL;
+
+      n_records = 0;
+      batch_bytes = 0;
+      batch.pending = 0;
+
+      /* Images make lines of many megabytes, so a batch is also capped by
+       * the bytes it holds; decoding never makes a line larger */
+      while (n_records < IMPORT_BATCH && batch_bytes < IMPORT_BATCH_BYTES)
+        {
+          line = g_data_input_stream_read_line (in, &length, cancellable,
+                                                &read_error);
+          if (!line)
+            {
+              eof = TRUE;
+              break;
+            }
+
+          batch_bytes += length;
+          records[n_records].line = line;
+          g_mutex_lock (&batch.lock);
+          batch.pending++;
+          g_mutex_unlock (&batch.lock);
+          g_thread_pool_push (pool, &records[n_records], NULL);
+          n_records++;
+        }
+
+      g_mutex_lock (&batch.lock);
+      while (batch.pending > 0)
+        g_cond_wait (&batch.done, &batch.lock);
+      g_mutex_unlock (&batch.lock);
+
+      if (read_error)
+        {
+          g_propagate_error (error, read_error);
+          ok = FALSE;
+        }
+      else
+        {
+          ok = import_commit (self, stmt, records, n_records, &imported,
+                              error);
+        }
+
+      for (guint i = 0; i < n_records; i++)
+        import_record_clear (&records[i]);
     }
 
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_cond_clear (&batch.done);
+  g_mutex_clear (&batch.lock);
+  g_free (records);
+  g_object_unref (in);
   sqlite3_finalize (stmt);
 
-  return items;
+  tune_database (self);
+  schedule_migration (self);
+
+  if (n_imported)
+    *n_imported = imported;
+
+  if (imported > 0)
+    schedule_snapshot (self);
+
+  return ok;
+}
+
+/* Backups belong next to the persistent copy, not a local one */
+static gchar *
+get_data_dir (ClipmanStorage *self)
+{
+  if (self->sync_dir)
+    return g_strdup (self->sync_dir);
+
+  return g_path_get_dirname (self->db_path);
+}
+
+static gchar *
+get_backup_path (ClipmanStorage *self, const gchar *name,
+                 const gchar *suffix)
+{
+  gchar *dir;
+  gchar *basename;
+  gchar *path;
+
+  dir = get_data_dir (self);
+  basename = g_strdup_printf ("%s.%s.db", name, suffix);
+  path = g_build_filename (dir, "backups", basename, NULL);
+  g_free (basename);
+  g_free (dir);
+
+  return path;
+}
+
+static void
+backup_cleanup (ClipmanStorage *self)
+{
+  if (self->backup)
+    {
+      sqlite3_backup_finish (self->backup);
+      self->backup = NULL;
+    }
+
+  if (self->backup_db)
+    {
+      sqlite3_close (self->backup_db);
+      self->backup_db = NULL;
+    }
+}
+
+static void
+rotate_backups (ClipmanStorage *self)
+{
+  for (guint s = 0; s < G_N_ELEMENTS (backup_names); s++)
+    {
+      gchar *from;
+      gchar *to;
+
+      /* Shift history.1.db to history.2.db and so on, dropping the oldest */
+      for (guint i = self->backup_count; i > 1; i--)
+        {
+          gchar *from_suffix = g_strdup_printf ("%u", i - 1);
+          gchar *to_suffix = g_strdup_printf ("%u", i);
+
+          from = get_backup_path (self, backup_names[s], from_suffix);
+          to = get_backup_path (self, backup_names[s], to_suffix);
+          g_rename (from, to);
+
+          g_free (from);
+          g_free (to);
+          g_free (from_suffix);
+          g_free (to_suffix);
+        }
+
+      from = get_backup_path (self, backup_names[s], "new");
+      to = get_backup_path (self, backup_names[s], "1");
+      if (g_rename (from, to) != 0)
+        g_warning ("Failed to rotate backup %s: %s", from,
+                   g_strerror (errno));
+
+      g_free (from);
+      g_free (to);
+    }
+}
+
+static gboolean
+backup_start_schema (ClipmanStorage *self)
+{
+  gchar *path;
+
+  path = get_backup_path (self, backup_names[self->backup_schema], "new");
+  g_unlink (path);
+
+  if (sqlite3_open (path, &self->backup_db) == SQLITE_OK)
+    self->backup = sqlite3_backup_init (self->backup_db, "main", self->db,
+                                        backup_schemas[self->backup_schema]);
+
+  if (!self->backup)
+    {
+      g_warning ("Cannot start backup to %s: %s", path,
+                 sqlite3_errmsg (self->backup_db));
+      backup_cleanup (self);
+      g_free (path);
+      return FALSE;
+    }
+
+  g_free (path);
+  return TRUE;
+}
+
+static gboolean on_backup_step (gpointer user_data);
+
+static gboolean
+on_backup_retry (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+
+  self->backup_idle_id
+      = g_idle_add_full (G_PRIORITY_LOW, on_backup_step, self, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_backup_step (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+  int rc;
+
+  /* The source is our own connection, so items written while the backup
+   * runs are copied along instead of restarting it.  Each step only holds
+   * the source for BACKUP_STEP_PAGES pages. */
+  rc = sqlite3_backup_step (self->backup, BACKUP_STEP_PAGES);
+  if (rc == SQLITE_OK)
+    return G_SOURCE_CONTINUE;
+
+  /* Another process holds the lock; don't spin in an idle until it's
+   * released */
+  if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+    {
+      self->backup_idle_id = g_timeout_add_seconds (1, on_backup_retry, self);
+      return G_SOURCE_REMOVE;
+    }
+
+  backup_cleanup (self);
+
+  if (rc == SQLITE_DONE)
+    {
+      if (++self->backup_schema < G_N_ELEMENTS (backup_schemas))
+        {
+          if (backup_start_schema (self))
+            return G_SOURCE_CONTINUE;
+        }
+      else
+        {
+          rotate_backups (self);
+          g_debug ("Backup of %s finished", self->db_path);
+        }
+    }
+  else
+    {
+      g_warning ("Backup of %s failed: %s", self->db_path,
+                 sqlite3_errstr (rc));
+    }
+
+  self->backup_idle_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_backup_timeout (gpointer user_data)
+{
+  ClipmanStorage *self = CLIPMAN_STORAGE (user_data);
+  gchar *dir;
+  gchar *backup_dir;
+
+  self->backup_timeout_id = 0;
+
+  /* A running backup also copies what was written since it started */
+  if (self->backup_idle_id > 0)
+    return G_SOURCE_REMOVE;
+
+  dir = get_data_dir (self);
+  backup_dir = g_build_filename (dir, "backups", NULL);
+  g_mkdir_with_parents (backup_dir, 0700);
+  g_free (backup_dir);
+  g_free (dir);
+
+  self->backup_schema = 0;
+  if (backup_start_schema (self))
+    self->backup_idle_id
+        = g_idle_add_full (G_PRIORITY_LOW, on_backup_step, self, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* The backup timer is only armed by a write, so an idle session never
+ * wakes up for it */
+static void
+schedule_backup (ClipmanStorage *self)
+{
+  if (self->backup_timeout_id > 0 || self->backup_interval == 0
+      || self->backup_count == 0)
+    return;
+
+  /* Nowhere to put backups of a history that only lives in memory */
+  if (!self->sync_dir && is_memory_path (self->db_path))
+    return;
+
+  self->backup_timeout_id = g_timeout_add_seconds (self->backup_interval,
+                                                   on_backup_timeout, self);
+}
+
+void
+clipman_storage_set_backup_policy (ClipmanStorage *self, guint interval,
+                                   guint n_snapshots)
+{
+  g_return_if_fail (CLIPMAN_IS_STORAGE (self));
+
+  self->backup_count = n_snapshots;
+  self->backup_interval = interval;
+
+  /* A pending backup keeps its time; the next write arms the new one */
+  if (self->backup_timeout_id > 0 && (interval == 0 || n_snapshots == 0))
+    {
+      g_source_remove (self->backup_timeout_id);
+      self->backup_timeout_id = 0;
+    }
+}
+
+/* Without autotuning the database runs with SQLite's defaults, so the
+ * storage benchmark can measure what tuning gains */
+void
+clipman_storage_set_autotune (ClipmanStorage *self, gboolean autotune)
+{
+  g_return_if_fail (CLIPMAN_IS_STORAGE (self));
+
+  self->untuned = !autotune;
+
+  if (!self->db)
+    return;
+
+  if (autotune)
+    tune_database (self);
+  else
+    sqlite3_exec (self->db,
+                  "PRAGMA cache_size=-2000;"
+                  "PRAGMA mmap_size=0;"
+                  "PRAGMA temp_store=DEFAULT;",
+                  NULL, NULL, NULL);
+}
+
+void
+clipman_storage_release_memory (ClipmanStorage *self)
+{
+  g_return_if_fail (CLIPMAN_IS_STORAGE (self));
+
+  /* Frees unused pages of both attached caches; they refill on demand */
+  if (self->db)
+    sqlite3_db_release_memory (self->db);
+}
+
+void
+clipman_storage_shrink_cache (ClipmanStorage *self)
+{
+  gchar *sql;
+
+  g_return_if_fail (CLIPMAN_IS_STORAGE (self));
+
+  if (!self->db)
+    return;
+
+  /* Drop to the smallest cache until the next write retunes it */
+  sql = g_strdup_printf ("PRAGMA cache_size=-%d;", CACHE_SIZE_MIN / 1024);
+  sqlite3_exec (self->db, sql, NULL, NULL, NULL);
+  g_free (sql);
+  sqlite3_db_release_memory (self->db);
+
+  self->cache_shrunk = TRUE;
 }
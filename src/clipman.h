@@ -27,15 +27,21 @@
 #ifndef __CLIPMAN_H__
 #define __CLIPMAN_H__
 
-#include <gdk/gdkx.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib/gi18n.h>
-#include <gtk/gtk.h>
 #include <sqlite3.h>
 #include <string.h>
 #include <time.h>
 
+/* The headless daemon builds items, storage and the D-Bus service without
+ * GTK */
+#ifndef CLIPMAN_HEADLESS
+#include <gdk/gdkx.h>
+#include <gtk/gtk.h>
+#endif
+
 G_BEGIN_DECLS
 
 /* Forward declarations */
@@ -45,6 +51,9 @@ typedef struct _ClipmanManager ClipmanManager;
 typedef struct _ClipmanStorage ClipmanStorage;
 typedef struct _ClipmanHistory ClipmanHistory;
 typedef struct _ClipmanPreferences ClipmanPreferences;
+typedef struct _ClipmanService ClipmanService;
+typedef struct _ClipmanSelection ClipmanSelection;
+typedef struct _ClipmanSnapshot ClipmanSnapshot;
 
 /* Item types */
 typedef enum
@@ -61,6 +70,73 @@ typedef enum
   CLIPMAN_SOURCE_PRIMARY
 } ClipmanSource;
 
+#define CLIPMAN_N_ITEM_TYPES 3
+#define CLIPMAN_N_SOURCES 2
+
+/* Storage statistics, indexed by ClipmanItemType and ClipmanSource */
+typedef struct
+{
+  gint64 n_items[CLIPMAN_N_ITEM_TYPES][CLIPMAN_N_SOURCES];
+  gint64 n_bytes[CLIPMAN_N_ITEM_TYPES][CLIPMAN_N_SOURCES];
+  gint64 total_items;
+  gint64 total_bytes;
+  gint64 n_contended; /* write transactions that waited for another writer */
+} ClipmanStorageStats;
+
+/* Size of image previews in the history popup */
+#define CLIPMAN_THUMBNAIL_SIZE 48
+
+/*
+ * ClipmanSnapshot - Memory-mapped list of the most recent items, kept up to
+ * date by ClipmanStorage so the popup can be drawn before the database is
+ * open
+ */
+#define CLIPMAN_SNAPSHOT_ITEMS 100
+
+typedef struct
+{
+  gint64 id;
+  gint64 timestamp;
+  ClipmanItemType type;
+  ClipmanSource source;
+  const gchar *label;
+  const guint8 *thumbnail; /* PNG, NULL if the item has none */
+  gsize thumbnail_size;
+} ClipmanSnapshotItem;
+
+gchar *clipman_snapshot_get_default_path (void);
+ClipmanSnapshot *clipman_snapshot_open (const gchar *path, GError **error);
+void clipman_snapshot_free (ClipmanSnapshot *snapshot);
+guint clipman_snapshot_get_n_items (ClipmanSnapshot *snapshot);
+void clipman_snapshot_get_item (ClipmanSnapshot *snapshot, guint index,
+                                ClipmanSnapshotItem *item);
+gboolean clipman_snapshot_find (ClipmanSnapshot *snapshot, gint64 id,
+                                ClipmanSnapshotItem *item);
+gboolean clipman_snapshot_write (const gchar *path,
+                                 const ClipmanSnapshotItem *items,
+                                 guint n_items, GError **error);
+
+/*
+ * Ingest latency - Log-scale histograms of how long each stage of storing
+ * a copy takes
+ */
+typedef enum
+{
+  CLIPMAN_STAGE_FETCH,   /* owner change until the data arrived */
+  CLIPMAN_STAGE_HASH,    /* checksum of the data */
+  CLIPMAN_STAGE_ENCODE,  /* PNG encoding of images */
+  CLIPMAN_STAGE_COMMIT,  /* write transaction of the item */
+  CLIPMAN_STAGE_REFRESH, /* reloading the open history popup */
+  CLIPMAN_N_STAGES
+} ClipmanStage;
+
+/* Bucket B counts durations below 2^B microseconds, down to 2^(B-1) */
+#define CLIPMAN_LATENCY_BUCKETS 32
+
+void clipman_latency_record (ClipmanStage stage, gint64 start);
+GVariant *clipman_latency_to_variant (void);
+gchar *clipman_latency_to_string (void);
+
 /*
  * ClipmanItem - Represents a single clipboard entry
  */
@@ -70,10 +146,16 @@ G_DECLARE_FINAL_TYPE (ClipmanItem, clipman_item, CLIPMAN, ITEM, GObject)
 ClipmanItem *clipman_item_new_text (const gchar *text, ClipmanSource source);
 ClipmanItem *clipman_item_new_image (GdkPixbuf *pixbuf, ClipmanSource source);
 ClipmanItem *clipman_item_new_files (gchar **uris, ClipmanSource source);
+ClipmanItem *clipman_item_new_stored (ClipmanItemType type,
+                                      ClipmanSource source,
+                                      const gchar *checksum,
+                                      const gchar *label, const gchar *text,
+                                      GdkPixbuf *pixbuf);
 
 ClipmanItemType clipman_item_get_item_type (ClipmanItem *self);
 const gchar *clipman_item_get_text (ClipmanItem *self);
 GdkPixbuf *clipman_item_get_pixbuf (ClipmanItem *self);
+GBytes *clipman_item_get_png (ClipmanItem *self);
 gchar **clipman_item_get_uris (ClipmanItem *self);
 const gchar *clipman_item_get_checksum (ClipmanItem *self);
 const gchar *clipman_item_get_label (ClipmanItem *self);
@@ -81,26 +163,59 @@ GDateTime *clipman_item_get_timestamp (ClipmanItem *self);
 ClipmanSource clipman_item_get_source (ClipmanItem *self);
 gint64 clipman_item_get_id (ClipmanItem *self);
 void clipman_item_set_id (ClipmanItem *self, gint64 id);
+void clipman_item_set_timestamp (ClipmanItem *self, gint64 unix_time);
+#ifndef CLIPMAN_HEADLESS
 void clipman_item_to_clipboard (ClipmanItem *self, GtkClipboard *clipboard);
+#endif
 gboolean clipman_item_equals (ClipmanItem *self, ClipmanItem *other);
 
 /*
  * ClipmanStorage - SQLite database storage
  */
+
+/* Item metadata as (id, type, source, label, timestamp) */
+#define CLIPMAN_ITEM_VARIANT_TYPE "(xuusx)"
+
 #define CLIPMAN_TYPE_STORAGE (clipman_storage_get_type ())
 G_DECLARE_FINAL_TYPE (ClipmanStorage, clipman_storage, CLIPMAN, STORAGE,
                       GObject)
 
 ClipmanStorage *clipman_storage_new (void);
+ClipmanStorage *clipman_storage_new_for_path (const gchar *path,
+                                              const gchar *sync_dir);
+void clipman_storage_new_async (GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data);
+ClipmanStorage *clipman_storage_new_finish (GAsyncResult *result,
+                                            GError **error);
+gchar *clipman_storage_get_default_dir (gchar **sync_dir);
 gboolean clipman_storage_add_item (ClipmanStorage *self, ClipmanItem *item);
 gboolean clipman_storage_remove_item (ClipmanStorage *self, gint64 id);
 GList *clipman_storage_get_items (ClipmanStorage *self, gint limit);
+ClipmanItem *clipman_storage_get_item (ClipmanStorage *self, gint64 id);
 ClipmanItem *clipman_storage_get_by_checksum (ClipmanStorage *self,
                                               const gchar *checksum);
 gboolean clipman_storage_clear (ClipmanStorage *self);
 GList *clipman_storage_search (ClipmanStorage *self, const gchar *query,
                                gint limit);
+GVariant *clipman_storage_list (ClipmanStorage *self, const gchar *query,
+                                guint offset, guint limit);
+GBytes *clipman_storage_get_content (ClipmanStorage *self, gint64 id,
+                                     ClipmanItemType *type);
+gboolean clipman_storage_get_stats (ClipmanStorage *self,
+                                    ClipmanStorageStats *stats);
+gboolean clipman_storage_export (ClipmanStorage *self, GOutputStream *stream,
+                                 GCancellable *cancellable, GError **error);
+gboolean clipman_storage_import (ClipmanStorage *self, GInputStream *stream,
+                                 guint *n_imported, GCancellable *cancellable,
+                                 GError **error);
+void clipman_storage_set_backup_policy (ClipmanStorage *self, guint interval,
+                                        guint n_snapshots);
+void clipman_storage_set_autotune (ClipmanStorage *self, gboolean autotune);
+void clipman_storage_release_memory (ClipmanStorage *self);
+void clipman_storage_shrink_cache (ClipmanStorage *self);
 
+#ifndef CLIPMAN_HEADLESS
 /*
  * ClipmanManager - Monitors clipboard changes
  */
@@ -109,9 +224,49 @@ G_DECLARE_FINAL_TYPE (ClipmanManager, clipman_manager, CLIPMAN, MANAGER,
                       GObject)
 
 ClipmanManager *clipman_manager_new (void);
+ClipmanManager *clipman_manager_new_for_display (GdkDisplay *display);
+GdkDisplay *clipman_manager_get_display (ClipmanManager *self);
 void clipman_manager_set_settings (ClipmanManager *self, GSettings *settings);
 void clipman_manager_start (ClipmanManager *self);
 void clipman_manager_stop (ClipmanManager *self);
+void clipman_manager_set_trace (ClipmanManager *self, GOutputStream *stream);
+#endif
+
+/*
+ * ClipmanService - D-Bus interface to the history, exported by the process
+ * that owns clipboard monitoring and storage
+ */
+#define CLIPMAN_SERVICE_NAME "org.mate.clipman"
+#define CLIPMAN_SERVICE_PATH "/org/mate/clipman"
+#define CLIPMAN_SERVICE_INTERFACE "org.mate.Clipman.History"
+
+#define CLIPMAN_TYPE_SERVICE (clipman_service_get_type ())
+G_DECLARE_FINAL_TYPE (ClipmanService, clipman_service, CLIPMAN, SERVICE,
+                      GObject)
+
+ClipmanService *clipman_service_new (ClipmanStorage *storage);
+gboolean clipman_service_export (ClipmanService *self,
+                                 GDBusConnection *connection, GError **error);
+void clipman_service_unexport (ClipmanService *self);
+
+/*
+ * ClipmanSelection - Monitors and serves the X selections of one display
+ * through Xlib and XFixes, for the headless daemon
+ */
+#define CLIPMAN_TYPE_SELECTION (clipman_selection_get_type ())
+G_DECLARE_FINAL_TYPE (ClipmanSelection, clipman_selection, CLIPMAN, SELECTION,
+                      GObject)
+
+ClipmanSelection *clipman_selection_new (const gchar *display_name,
+                                         GError **error);
+void clipman_selection_set_settings (ClipmanSelection *self,
+                                     GSettings *settings);
+void clipman_selection_start (ClipmanSelection *self);
+void clipman_selection_stop (ClipmanSelection *self);
+void clipman_selection_set_item (ClipmanSelection *self, ClipmanItem *item,
+                                 ClipmanSource source);
+
+#ifndef CLIPMAN_HEADLESS
 
 /*
  * ClipmanHistory - History popup window
@@ -122,8 +277,11 @@ G_DECLARE_FINAL_TYPE (ClipmanHistory, clipman_history, CLIPMAN, HISTORY,
 
 ClipmanHistory *clipman_history_new (ClipmanStorage *storage,
                                      GSettings *settings);
+void clipman_history_set_storage (ClipmanHistory *self,
+                                  ClipmanStorage *storage);
 void clipman_history_show_popup (ClipmanHistory *self);
 void clipman_history_refresh (ClipmanHistory *self);
+void clipman_history_release_rows (ClipmanHistory *self);
 
 /*
  * ClipmanPreferences - Preferences dialog
@@ -142,6 +300,7 @@ ClipmanPreferences *clipman_preferences_new (GtkWindow *parent,
 G_DECLARE_FINAL_TYPE (ClipmanApp, clipman_app, CLIPMAN, APP, GtkApplication)
 
 ClipmanApp *clipman_app_new (void);
+#endif
 
 G_END_DECLS
 